@@ -1,6 +1,11 @@
 #ifndef DOCOPT_H
 #define DOCOPT_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
 typedef enum {
     DOCOPT_PROGRAM_NAME,
     DOCOPT_SUBCOMMAND,
@@ -9,15 +14,159 @@ typedef enum {
     DOCOPT_ELEMENT_COUNT,
 } Docopt_Element_Kind;
 
+typedef enum {
+    DOCOPT_VALUE_NONE,
+    DOCOPT_VALUE_STRING,
+    DOCOPT_VALUE_BOOL,
+    DOCOPT_VALUE_INT,
+    DOCOPT_VALUE_DOUBLE,
+} Docopt_Value_Kind;
+
+// Where the value of an option comes from, from the lowest to the highest priority.
+typedef enum {
+    DOCOPT_SOURCE_DEFAULT,
+    DOCOPT_SOURCE_CONFIG,
+    DOCOPT_SOURCE_ENVIRONMENT,
+    DOCOPT_SOURCE_ARGV,
+} Docopt_Value_Source;
+
+// The value of an option, string is its text. Defaults are converted once when
+// the pattern is compiled, the values of argv are strings.
+typedef struct {
+    Docopt_Value_Kind kind;
+    Docopt_Value_Source source;
+    const char *string;
+    union {
+        bool b;
+        int64_t i64;
+        double f64;
+    };
+} Docopt_Value;
+
+typedef struct Docopt__Arena_Block Docopt__Arena_Block;
+typedef struct Docopt__Config Docopt__Config;
+
+typedef struct {
+    Docopt__Arena_Block *block;
+    bool fixed;
+} Docopt__Arena;
+
 typedef struct {
+    // NULL if argv matches one of the usage patterns
+    const char *error;
     int count;
     Docopt_Element_Kind *kind;
     const char **key;
     const char **value;
+    // values[i] points to the length[i] values of the i-th entry, value[i] is the first.
+    // A repeated argument like <file>... is a single entry that points into argv.
+    const char ***values;
+    int *length;
+    // Bit i of options is set if the i-th option of the Options section was
+    // given, option_key[i] is its key. Such options without value have no entry.
+    uint64_t *options;
+    int option_count;
+    const char *const *option_key;
+    // occurrences[i] counts how often the i-th option was given, 3 for -vvv.
+    // An option with a value given more than once is a single entry with all its values.
+    int *occurrences;
+    // option_value[i] is the last value of the i-th option, its default if it
+    // was not given, or DOCOPT_VALUE_NONE if there is neither. docopt_get_*
+    // replaces a default by the value of the config file once it is read.
+    Docopt_Value *option_value;
+    // the config file of docopt_match_config, if any
+    Docopt__Config *config;
+    Docopt__Arena arena;
 } Docopt_Match;
 
+typedef struct Docopt__Pattern Docopt_Pattern;
+
+typedef enum {
+    // like options_first of docopt: the elements after the first positional one
+    // are arguments, even if they look like options
+    DOCOPT_OPTIONS_FIRST = 1 << 0,
+} Docopt_Flag;
+
+// A pattern compiles its usage lines the first time a match needs them.
+// Threads may match with the same pattern at the same time.
+Docopt_Pattern *docopt_compile(const char *help);
+Docopt_Pattern *docopt_compile_ex(const char *help, int flags);
+Docopt_Match docopt_match(const Docopt_Pattern *pattern, int argc, const char **argv);
 Docopt_Match docopt_interpret(const char *help, int argc, const char **argv);
 
+// The bit of an option in Docopt_Match.options, -1 if the Options section does
+// not describe it. The short and the long key of an option share their bit.
+int docopt_option_bit(const Docopt_Pattern *pattern, const char *key);
+
+// Typed values of the option or argument reported as key, the first value of a
+// repeated argument. They return false if there is no value, or if it is
+// malformed or out of range; the parsers do not depend on the locale.
+// Durations like 1h30m, 250ms or 10 (seconds) are in milliseconds,
+// sizes like 10M or 2GiB in bytes with K = 1024. They take the match mutably
+// since they cache what they read from a config file in it.
+bool docopt_get_i64(Docopt_Match *match, const char *key, int64_t *value);
+bool docopt_get_f64(Docopt_Match *match, const char *key, double *value);
+bool docopt_get_duration(Docopt_Match *match, const char *key, int64_t *milliseconds);
+bool docopt_get_size(Docopt_Match *match, const char *key, uint64_t *bytes);
+
+// Config files: docopt_match_config maps the file the option key names, like
+// --config=FILE, as defaults of lines like speed = 10 for --speed. They rank
+// below argv and the environment and above [default: ...]. A line is only read
+// when docopt_get_* asks for an option that is not given otherwise; the value
+// found replaces the default in option_value with source DOCOPT_SOURCE_CONFIG,
+// such that later queries do not read the file again. option_value holds no
+// value of the file until then. Returns false if the file can not be read.
+bool docopt_match_config(Docopt_Match *match, const char *key);
+
+// Both release everything with a single call; the pointers inside become invalid.
+// A match returned by docopt_match borrows its keys from the pattern.
+void docopt_pattern_free(Docopt_Pattern *pattern);
+void docopt_match_free(Docopt_Match *match);
+
+// Bounded-memory matching: docopt_match_size returns the number of bytes
+// docopt_match_buffer needs at most for the given pattern and argv; it looks
+// at argv for the stacked short options like -vq, which count as one element
+// each. After docopt_match_size, docopt_match_buffer never calls malloc;
+// it returns false if the buffer is too small.
+size_t docopt_match_size(const Docopt_Pattern *pattern, int argc, const char **argv);
+bool docopt_match_buffer(const Docopt_Pattern *pattern, int argc, const char **argv, void *buffer, size_t size, Docopt_Match *match);
+
+// JSON in the format of testcases.docopt: every key of the usage lines and the
+// Options section, false, null, 0 or [] if argv does not give it, and the
+// default of options. docopt_match_json writes like snprintf at most size bytes
+// including the NUL to buffer and returns the length of the whole JSON.
+// Both return the number of bytes.
+size_t docopt_match_json(const Docopt_Pattern *pattern, const Docopt_Match *match, char *buffer, size_t size);
+size_t docopt_match_json_file(const Docopt_Pattern *pattern, const Docopt_Match *match, FILE *file);
+
+typedef struct Docopt__Matcher Docopt_Matcher;
+
+// Streaming: docopt_feed matches the elements of argv one at a time, starting
+// with the program name, and returns false as soon as no usage line can match
+// the elements fed so far. docopt_matcher_match returns the match of all elements
+// fed; its values point into the matcher, free the match first.
+Docopt_Matcher *docopt_matcher_new(const Docopt_Pattern *pattern);
+bool docopt_feed(Docopt_Matcher *matcher, const char *arg);
+Docopt_Match docopt_matcher_match(Docopt_Matcher *matcher);
+void docopt_matcher_free(Docopt_Matcher *matcher);
+
+// Response files: docopt_feed_expand feeds arg like docopt_feed unless it is
+// @path, then it feeds the lines of the file at path instead. The file is read
+// into the matcher at once and its lines are terminated in place; pipes like
+// @<(printf ...) are read until their end.
+bool docopt_feed_expand(Docopt_Matcher *matcher, const char *arg);
+
+typedef struct Docopt__Completion Docopt_Completion;
+
+// Shell completion: docopt_complete stores in words the commands, options and
+// argument placeholders that may replace argv[argc-1], the word under the cursor,
+// and returns their number. The words stay valid until the next call.
+// A completion keeps the matcher state of the previous call, such that only
+// the elements of argv that changed since then are matched again.
+Docopt_Completion *docopt_completion_new(const Docopt_Pattern *pattern);
+int docopt_complete(Docopt_Completion *completion, int argc, const char **argv, const char ***words);
+void docopt_completion_free(Docopt_Completion *completion);
+
 #endif // DOCOPT_H
 
 #ifdef DOCOPT_IMPLEMENTATION
@@ -26,11 +175,110 @@ Docopt_Match docopt_interpret(const char *help, int argc, const char **argv);
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define DOCOPT_SHORT_STRLEN 64
 
+// Everything the compiler and the matcher allocate lives in an arena
+// of malloc'ed blocks, such that it can be freed all at once.
+// A fixed arena instead lives in a single caller provided buffer and never grows.
+#define DOCOPT__ARENA_BLOCK_SIZE 4096
+#define DOCOPT__ARENA_ALIGN(n) (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+struct Docopt__Arena_Block {
+    struct Docopt__Arena_Block *next;
+    size_t capacity;
+    size_t count;
+    max_align_t data[];
+};
+
+void *docopt__arena_alloc(Docopt__Arena *a, size_t size) {
+    size = DOCOPT__ARENA_ALIGN(size);
+    Docopt__Arena_Block *b = a->block;
+    if (b == NULL || b->count + size > b->capacity) {
+        // users of a fixed arena have to size it with docopt__match_size upfront
+        assert(!a->fixed);
+        size_t capacity = size > DOCOPT__ARENA_BLOCK_SIZE ? size : DOCOPT__ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(Docopt__Arena_Block) + capacity);
+        assert(b != NULL);
+        b->next = a->block;
+        b->capacity = capacity;
+        b->count = 0;
+        a->block = b;
+    }
+    void *result = (char *) b->data + b->count;
+    b->count += size;
+    memset(result, 0, size);
+    return result;
+}
+
+char *docopt__arena_strdup(Docopt__Arena *a, const char *str) {
+    size_t n = strlen(str);
+    char *result = docopt__arena_alloc(a, n+1);
+    memcpy(result, str, n+1);
+    return result;
+}
+
+Docopt__Arena docopt__arena_fixed(void *buffer, size_t size) {
+    Docopt__Arena result = {0};
+    result.fixed = true;
+
+    uintptr_t start = DOCOPT__ARENA_ALIGN((uintptr_t) buffer);
+    if (start - (uintptr_t) buffer + sizeof(Docopt__Arena_Block) > size) return result;
+
+    Docopt__Arena_Block *b = (Docopt__Arena_Block *) start;
+    b->next = NULL;
+    b->capacity = size - (start - (uintptr_t) buffer) - sizeof(Docopt__Arena_Block);
+    b->count = 0;
+    result.block = b;
+    return result;
+}
+
+// Upper bound of bytes a fixed arena needs to serve allocations of the given sizes.
+size_t docopt__arena_fixed_size(const size_t *sizes, size_t count) {
+    size_t result = _Alignof(max_align_t) - 1 + sizeof(Docopt__Arena_Block);
+    for (size_t i=0; i<count; i++) {
+        result += DOCOPT__ARENA_ALIGN(sizes[i]);
+    }
+    return result;
+}
+
+// Hands all blocks of src over to dst, such that freeing dst also frees them.
+void docopt__arena_move(Docopt__Arena *dst, Docopt__Arena *src) {
+    assert(!dst->fixed);
+    assert(!src->fixed);
+    if (src->block == NULL) return;
+    Docopt__Arena_Block *last = src->block;
+    while (last->next != NULL) last = last->next;
+    last->next = dst->block;
+    dst->block = src->block;
+    src->block = NULL;
+}
+
+void docopt__arena_free(Docopt__Arena *a) {
+    if (a->fixed) {
+        a->block = NULL;
+        return;
+    }
+    Docopt__Arena_Block *b = a->block;
+    while (b != NULL) {
+        Docopt__Arena_Block *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->block = NULL;
+}
+
 typedef struct {
     char it[DOCOPT_SHORT_STRLEN];
 } Docopt__Short_String;
@@ -97,7 +345,7 @@ bool docopt__is_option(const char *str) {
     return false;
 }
 
-Docopt__Short_String docopt__word(char **rest) {
+Docopt__Short_String docopt__word(const char **rest) {
     Docopt__Short_String result;
 
     while (isspace(**rest)) (*rest)++;
@@ -147,28 +395,24 @@ typedef struct Docopt__UPattern {
     bool optional;
     bool alternative;
     bool repeat;
-    struct Docopt__UPattern *head;
-    struct Docopt__UPattern *rest;
+    const struct Docopt__UPattern *head;
+    const struct Docopt__UPattern *rest;
 } Docopt__UPattern;
 
-static Docopt__UPattern *docopt__new_upattern_simple(const char *name) {
-    // TODO: allocate the struct in an arena or something similar such that it can be freed all at once
-    Docopt__UPattern *result = malloc(sizeof(Docopt__UPattern));
-    assert(result != NULL);
+static Docopt__UPattern *docopt__new_upattern_simple(Docopt__Arena *arena, const char *name) {
+    Docopt__UPattern *result = docopt__arena_alloc(arena, sizeof(Docopt__UPattern));
     result->kind = DOCOPT__UPATTERN_SIMPLE;
     result->name = docopt__make_short_string(name, strlen(name));
     return result;
 }
 
-static Docopt__UPattern *docopt__new_upattern_group() {
-    Docopt__UPattern *result = malloc(sizeof(Docopt__UPattern));
-    assert(result != NULL);
-    memset(result, 0, sizeof(Docopt__UPattern));
+static Docopt__UPattern *docopt__new_upattern_group(Docopt__Arena *arena) {
+    Docopt__UPattern *result = docopt__arena_alloc(arena, sizeof(Docopt__UPattern));
     result->kind = DOCOPT__UPATTERN_GROUP;
     return result;
 }
 
-void docopt__compile_upattern_ex(char **code, Docopt__UPattern *result) {
+void docopt__compile_upattern_ex(Docopt__Arena *arena, const char **code, Docopt__UPattern *result) {
     Docopt__Short_String word = docopt__word(code);
     if (word.it[0] == '\0') {
         assert(result->head != NULL);
@@ -177,19 +421,19 @@ void docopt__compile_upattern_ex(char **code, Docopt__UPattern *result) {
 
     Docopt__UPattern *head;
     if (docopt__is_argument(word.it)) {
-        head = docopt__new_upattern_simple(word.it);
+        head = docopt__new_upattern_simple(arena, word.it);
     } else if (docopt__is_option(word.it)) {
-        head = docopt__new_upattern_simple(word.it);
+        head = docopt__new_upattern_simple(arena, word.it);
     } else if (strcmp("[", word.it) == 0) {
-        head = docopt__new_upattern_group();
+        head = docopt__new_upattern_group(arena);
         head->optional = true;
-        docopt__compile_upattern_ex(code, head);
+        docopt__compile_upattern_ex(arena, code, head);
     } else if (strcmp("]", word.it) == 0) {
         assert(result->head != NULL);
         return;
     } else if (strcmp("(", word.it) == 0) {
-        head = docopt__new_upattern_group();
-        docopt__compile_upattern_ex(code, head);
+        head = docopt__new_upattern_group(arena);
+        docopt__compile_upattern_ex(arena, code, head);
     } else if (strcmp(")", word.it) == 0) {
         assert(result->head != NULL);
         return;
@@ -197,7 +441,7 @@ void docopt__compile_upattern_ex(char **code, Docopt__UPattern *result) {
         assert(result->kind == DOCOPT__UPATTERN_GROUP);
         assert(result->head != NULL);
         result->alternative = true;
-        docopt__compile_upattern_ex(code, result);
+        docopt__compile_upattern_ex(arena, code, result);
         return;
     } else if (strcmp("...", word.it) == 0) {
         assert(result->kind == DOCOPT__UPATTERN_GROUP);
@@ -205,35 +449,93 @@ void docopt__compile_upattern_ex(char **code, Docopt__UPattern *result) {
         result->repeat = true;
         return;
     } else {
-        head = docopt__new_upattern_simple(word.it);
+        head = docopt__new_upattern_simple(arena, word.it);
     }
 
     if (result->head == NULL) {
         result->head = head;
         result->rest = NULL;
 
-        docopt__compile_upattern_ex(code, result);
+        docopt__compile_upattern_ex(arena, code, result);
 
         return;
     } else {
         assert(result->rest == NULL);
 
-        result->rest = docopt__new_upattern_group();
-        result->rest->head = head;
-        docopt__compile_upattern_ex(code, result->rest);
+        Docopt__UPattern *rest = docopt__new_upattern_group(arena);
+        rest->head = head;
+        result->rest = rest;
+        docopt__compile_upattern_ex(arena, code, rest);
 
         return;
     }
 }
 
-Docopt__UPattern docopt__compile_upattern(const char *code) {
+Docopt__UPattern docopt__compile_upattern(Docopt__Arena *arena, const char *code) {
     Docopt__UPattern result = {0};
 
     result.kind = DOCOPT__UPATTERN_ROOT;
-    char *code_cpy = strdup(code); // TODO: free this memory
 
-    docopt__compile_upattern_ex(&code_cpy, &result);
+    docopt__compile_upattern_ex(arena, &code, &result);
+
+    return result;
+}
+
+// Whether p is a group (a b c) that may be spliced into the sequence it is part of.
+bool docopt__upattern_is_plain(const Docopt__UPattern *p) {
+    if (p->kind != DOCOPT__UPATTERN_GROUP || p->optional) return false;
+    for (; p != NULL; p = p->rest) {
+        if (p->alternative) return false;
+    }
+    return true;
+}
+
+const Docopt__UPattern *docopt__simplify_chain(Docopt__Arena *arena, const Docopt__UPattern *p, const Docopt__UPattern *tail);
+
+const Docopt__UPattern *docopt__simplify_element(Docopt__Arena *arena, const Docopt__UPattern *p) {
+    if (p->kind == DOCOPT__UPATTERN_SIMPLE) return p;
+    return docopt__simplify_chain(arena, p, NULL);
+}
+
+// Rewrites the sequence of groups at p followed by tail into fewer nodes:
+// a plain group (a b) is spliced into the sequence around it, and a group of
+// a single element such as (a) or the last of a sequence is the element itself.
+// p is left as is, the new nodes are allocated in arena.
+const Docopt__UPattern *docopt__simplify_chain(Docopt__Arena *arena, const Docopt__UPattern *p, const Docopt__UPattern *tail) {
+    if (p == NULL) return tail;
+    assert(p->kind == DOCOPT__UPATTERN_GROUP);
+    Docopt__UPattern *result;
+    if (p->alternative) {
+        assert(tail == NULL);
+        result = docopt__new_upattern_group(arena);
+        *result = *p;
+        result->head = docopt__simplify_element(arena, p->head);
+        result->rest = docopt__simplify_chain(arena, p->rest, NULL);
+        return result;
+    }
+
+    const Docopt__UPattern *rest = docopt__simplify_chain(arena, p->rest, tail);
+    if (p->optional || p->repeat) {
+        result = docopt__new_upattern_group(arena);
+        *result = *p;
+        result->head = docopt__simplify_element(arena, p->head);
+        result->rest = rest;
+        return result;
+    }
+    if (docopt__upattern_is_plain(p->head)) return docopt__simplify_chain(arena, p->head, rest);
+    const Docopt__UPattern *head = docopt__simplify_element(arena, p->head);
+    if (rest == NULL) return head;
+    result = docopt__new_upattern_group(arena);
+    result->head = head;
+    result->rest = rest;
+    return result;
+}
 
+// The usage line root with fewer nodes for docopt__glushkov to visit.
+Docopt__UPattern docopt__simplify_upattern(Docopt__Arena *arena, const Docopt__UPattern *root) {
+    assert(root->kind == DOCOPT__UPATTERN_ROOT);
+    Docopt__UPattern result = *root;
+    result.rest = docopt__simplify_chain(arena, root->rest, NULL);
     return result;
 }
 
@@ -242,13 +544,17 @@ Docopt__UPattern docopt__compile_upattern(const char *code) {
 typedef struct {
     Docopt__Short_String key[DOCOPT__OPTION_KEY_CAPACITY];
     Docopt__Short_String value;
-    const char *def;
+    // the text of [default: ...], empty if there is none
+    Docopt__Short_String def;
+    Docopt_Value def_value;
+    // the environment variable of [env: NAME], empty if there is none
+    Docopt__Short_String env;
 } Docopt__OPattern;
 
-Docopt__Short_String docopt__oword(char **code) {
+Docopt__Short_String docopt__oword(const char **code) {
     Docopt__Short_String result;
     result.it[0] = '\0';
-    char *cursor = *code;
+    const char *cursor = *code;
     if (cursor[0] == '\0') return result;
     if (docopt__str_isprefix("  ", cursor)) return result;
 
@@ -266,17 +572,218 @@ Docopt__Short_String docopt__oword(char **code) {
     return result;
 }
 
+bool docopt__str_isprefix_nocase(const char *prefix, const char *str) {
+    for (; *prefix != '\0'; prefix++, str++) {
+        if (tolower((unsigned char) *prefix) != tolower((unsigned char) *str)) return false;
+    }
+    return true;
+}
+
+bool docopt__is_digit(char c) {
+    return (unsigned) (c - '0') < 10;
+}
+
+// The number parsers read a prefix of s independent of the locale and return
+// the end of the number, or NULL if there is none or it does not fit.
+const char *docopt__parse_u64(const char *s, uint64_t *value) {
+    if (!docopt__is_digit(*s)) return NULL;
+    uint64_t n = 0;
+    for (; docopt__is_digit(*s); s++) {
+        unsigned d = *s - '0';
+        if (n > (UINT64_MAX - d) / 10) return NULL;
+        n = n * 10 + d;
+    }
+    *value = n;
+    return s;
+}
+
+const char *docopt__parse_i64(const char *s, int64_t *value) {
+    bool negative = *s == '-';
+    if (*s == '-' || *s == '+') s++;
+    uint64_t n;
+    s = docopt__parse_u64(s, &n);
+    if (s == NULL) return NULL;
+    if (n > (uint64_t) INT64_MAX + negative) return NULL;
+    *value = negative ? -(int64_t) (n - 1) - 1 : (int64_t) n;
+    return s;
+}
+
+// The C locale, created once for all threads: strtod reads the decimal point
+// of the locale of the thread, like 1,5 under de_DE. (locale_t) 0 if there is no memory.
+locale_t docopt__c_locale(void) {
+    static _Atomic(locale_t) cached = (locale_t) 0;
+    locale_t result = atomic_load_explicit(&cached, memory_order_acquire);
+    if (result != (locale_t) 0) return result;
+    locale_t created = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+    if (created == (locale_t) 0) return created;
+    if (atomic_compare_exchange_strong_explicit(&cached, &result, created, memory_order_acq_rel, memory_order_acquire)) return created;
+    // another thread was first, result is its locale
+    freelocale(created);
+    return result;
+}
+
+// Exact for up to 19 significant digits below 2^53 and exponents within 22,
+// which covers what command lines pass; strtod rounds the rest in the C locale.
+const char *docopt__parse_f64(const char *s, double *value) {
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    const char *start = s;
+    bool negative = *s == '-';
+    if (*s == '-' || *s == '+') s++;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int64_t exponent = 0;
+    bool any = false;
+    for (; docopt__is_digit(*s); s++) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*s - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+    }
+    if (*s == '.') {
+        for (s++; docopt__is_digit(*s); s++) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*s - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (!any) return NULL;
+    if (*s == 'e' || *s == 'E') {
+        int64_t e;
+        const char *end = docopt__parse_i64(s+1, &e);
+        if (end == NULL) return NULL;
+        if (e > 100000 || e < -100000) return NULL;
+        exponent += e;
+        s = end;
+    }
+
+    double result;
+    if (mantissa <= (uint64_t) 1 << 53 && exponent >= -22 && exponent <= 22) {
+        result = exponent < 0 ? (double) mantissa / pow10[-exponent] : (double) mantissa * pow10[exponent];
+        if (negative) result = -result;
+    } else {
+        locale_t c = docopt__c_locale();
+        if (c == (locale_t) 0) return NULL;
+        locale_t previous = uselocale(c);
+        char *end;
+        result = strtod(start, &end);
+        uselocale(previous);
+        if (end != s) return NULL;
+    }
+    if (isinf(result)) return NULL;
+    *value = result;
+    return s;
+}
+
+// Durations are sequences of numbers with a unit, like 1h30m; a single number
+// without a unit is in seconds.
+const char *docopt__parse_duration(const char *s, int64_t *milliseconds) {
+    static const struct {
+        const char *unit;
+        double milliseconds;
+    } units[] = {
+        {"ms", 1}, {"s", 1e3}, {"m", 60e3}, {"h", 3600e3}, {"d", 86400e3},
+    };
+    if (!docopt__is_digit(*s) && *s != '.') return NULL;
+    double total = 0;
+    bool first = true;
+    while (docopt__is_digit(*s) || *s == '.') {
+        double x;
+        s = docopt__parse_f64(s, &x);
+        if (s == NULL) return NULL;
+        size_t u = 0;
+        while (u < sizeof(units)/sizeof(units[0]) && !docopt__str_isprefix(units[u].unit, s)) u++;
+        if (u == sizeof(units)/sizeof(units[0])) {
+            if (!first) return NULL;
+            total = x * 1e3;
+            break;
+        }
+        total += x * units[u].milliseconds;
+        s += strlen(units[u].unit);
+        first = false;
+    }
+    if (!(total < 9.2e18)) return NULL;
+    *milliseconds = (int64_t) (total + 0.5);
+    return s;
+}
+
+// Sizes are a number with an optional binary suffix K, M, G, T, P or E,
+// optionally followed by B or iB.
+const char *docopt__parse_size(const char *s, uint64_t *bytes) {
+    uint64_t n;
+    s = docopt__parse_u64(s, &n);
+    if (s == NULL) return NULL;
+    const char *suffix = strchr("KMGTPE", toupper((unsigned char) *s));
+    int shift = 0;
+    if (*s != '\0' && suffix != NULL) {
+        shift = 10 * (int) (suffix - "KMGTPE" + 1);
+        s++;
+        if (*s == 'i') s++;
+    }
+    if (*s == 'B') s++;
+    if (shift > 0 && n > UINT64_MAX >> shift) return NULL;
+    *bytes = n << shift;
+    return s;
+}
+
+// Converts the text of a default to the first of bool, int and double it is
+// written as, a string otherwise. The string of the result is left to the caller.
+Docopt_Value docopt__parse_value(const char *text) {
+    Docopt_Value result = {0};
+    result.kind = DOCOPT_VALUE_STRING;
+    if (text[0] == '\0') return result;
+    if (strcmp(text, "true") == 0 || strcmp(text, "false") == 0) {
+        result.kind = DOCOPT_VALUE_BOOL;
+        result.b = text[0] == 't';
+        return result;
+    }
+    const char *end = docopt__parse_i64(text, &result.i64);
+    if (end != NULL && *end == '\0') {
+        result.kind = DOCOPT_VALUE_INT;
+        return result;
+    }
+    end = docopt__parse_f64(text, &result.f64);
+    if (end != NULL && *end == '\0') {
+        result.kind = DOCOPT_VALUE_DOUBLE;
+        return result;
+    }
+    result.f64 = 0;
+    return result;
+}
+
+// The text of an annotation like [default: 10] in the description of an option,
+// where name is "[default:". Empty if there is none.
+Docopt__Short_String docopt__annotation(const char *description, const char *name) {
+    Docopt__Short_String result = {0};
+    for (const char *c = description; (c = strchr(c, '[')) != NULL; c++) {
+        if (!docopt__str_isprefix_nocase(name, c)) continue;
+        c += strlen(name);
+        while (c[0] == ' ') c++;
+        const char *end = strchr(c, ']');
+        if (end == NULL) break;
+        return docopt__make_short_string(c, end - c);
+    }
+    return result;
+}
+
 Docopt__OPattern docopt__compile_opattern(const char *code) {
     while (isspace(code[0])) code++;
     assert(code[0] == '-');
-    char *code_cpy = strdup(code); // TODO: free this memory
 
     Docopt__OPattern result = {0};
     size_t key_count = 0;
     for (
-            Docopt__Short_String word = docopt__oword(&code_cpy); 
+            Docopt__Short_String word = docopt__oword(&code); 
             word.it[0] != '\0'; 
-            word = docopt__oword(&code_cpy)
+            word = docopt__oword(&code)
             ) {
         if (word.it[0] == '-') {
             assert(key_count < DOCOPT__OPTION_KEY_CAPACITY);
@@ -286,146 +793,310 @@ Docopt__OPattern docopt__compile_opattern(const char *code) {
             result.value = word;
         }
     }
-    // TODO: handle default values
-    result.def = NULL;
+    result.def = docopt__annotation(code, "[default:");
+    if (result.def.it[0] != '\0') result.def_value = docopt__parse_value(result.def.it);
+    result.env = docopt__annotation(code, "[env:");
     return result;
 }
 
+// Sets of leaves are bitsets of 64 bit words.
+#define DOCOPT__SET_WORDS(n) (((n) + 63) / 64)
+
+void docopt__set_add(uint64_t *set, size_t i) {
+    set[i / 64] |= (uint64_t) 1 << (i % 64);
+}
+
+bool docopt__set_has(const uint64_t *set, size_t i) {
+    return (set[i / 64] >> (i % 64)) & 1;
+}
+
+void docopt__set_union(uint64_t *dst, const uint64_t *src, size_t words) {
+    for (size_t i=0; i<words; i++) dst[i] |= src[i];
+}
+
+bool docopt__set_isempty(const uint64_t *set, size_t words) {
+    for (size_t i=0; i<words; i++) {
+        if (set[i] != 0) return false;
+    }
+    return true;
+}
+
+// Returns the smallest element of set that is at least i, or count if there is none.
+size_t docopt__set_next(const uint64_t *set, size_t i, size_t count) {
+    while (i < count) {
+        uint64_t w = set[i / 64] >> (i % 64);
+        if (w != 0) {
+            i += __builtin_ctzll(w);
+            return i < count ? i : count;
+        }
+        i = (i / 64 + 1) * 64;
+    }
+    return count;
+}
+
+typedef enum {
+    DOCOPT__LEAF_PROGRAM,
+    DOCOPT__LEAF_COMMAND,
+    DOCOPT__LEAF_ARGUMENT,
+    // an option without value or with its value attached (--speed=10, -ofile)
+    DOCOPT__LEAF_OPTION,
+    // an option whose value follows as the next element of argv
+    DOCOPT__LEAF_OPTION_KEY,
+    DOCOPT__LEAF_OPTION_VALUE,
+
+    DOCOPT__LEAF_KIND_COUNT,
+} Docopt__Leaf_Kind;
+
 typedef struct {
-    size_t upattern_count;
-    Docopt__UPattern *upattern;
-    size_t opattern_count;
-    Docopt__OPattern *opattern;
-} Docopt__Pattern;
+    Docopt__Leaf_Kind kind;
+    const Docopt__UPattern *node;
+    // the description in the Options section, if any
+    const Docopt__OPattern *option;
+    // the key of the match for options, e.g. --speed for [--speed=<kn>]
+    Docopt__Short_String key;
+    bool takes_value;
+    // whether a leaf with the same key may follow it in a match, like the
+    // leaves of <file>... and of go go, such that its key counts or lists
+    bool repeats;
+    // 1 + the bit of the option in the match, 0 if the Options section does not describe it
+    int bit;
+    // the hashes of the command name or of the option keys, compared before the strings
+    uint64_t hash[DOCOPT__OPTION_KEY_CAPACITY];
+} Docopt__Leaf;
 
-Docopt__Pattern docopt__compile_pattern(const char *msg) {
-    Docopt__Pattern result = {0};
-    size_t upattern_cap = 16;
-    size_t opattern_cap = 16;
-    result.upattern = malloc(upattern_cap * sizeof(Docopt__UPattern));
-    result.opattern = malloc(opattern_cap * sizeof(Docopt__OPattern));
+// FNV-1a over the n bytes of s.
+uint64_t docopt__hash(const char *s, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i=0; i<n; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
 
-    char *msg_cpy = strdup(msg); // TODO: free this memory
+// A usage line as Glushkov automaton: the states are the leaves of the
+// usage pattern, follow[i] holds the leaves that may consume the element of
+// argv after leaf i, last holds the leaves that may consume the last one.
+// Leaf 0 always is the program name.
+// The automaton is LL(1) if no two leaves of any follow set may consume the
+// same element, then the next element alone tells which leaf to follow.
+typedef struct {
+    size_t leaf_count;
+    const Docopt__Leaf *leaf;
+    size_t words;
+    const uint64_t *follow;
+    const uint64_t *last;
+    bool ll1;
+} Docopt__Automaton;
 
-    enum {
-        STATE_START,
-        STATE_USAGE,
-        STATE_OPTIONS,
-    } state = STATE_START;
+const uint64_t *docopt__automaton_follow(const Docopt__Automaton *a, size_t leaf) {
+    return a->follow + leaf * a->words;
+}
 
-    for (const char *line = docopt__parse_line(msg_cpy); line; line = docopt__parse_line(NULL)) {
-        switch (state) {
-            case STATE_START:
-                if (docopt__str_isprefix("Usage:", line)) {
-                    if (!docopt__str_isspace(line + strlen("Usage:"))) {
-                        // TODO: handle the usage pattern that is on this line
-                        assert(0);
-                    }
-                    state = STATE_USAGE;
-                }
-                if (docopt__str_isprefix("Options:", line)) {
-                    state = STATE_OPTIONS;
-                }
-                break;
-            case STATE_USAGE:
-                if (docopt__str_isspace(line)) {
-                    state = STATE_START;
-                    break;
-                }
-                {
-                    Docopt__UPattern p = docopt__compile_upattern(line);
-                    // TODO: reallocate if capacity is exceeded
-                    assert(result.upattern_count < upattern_cap);
-                    result.upattern[result.upattern_count] = p;
-                    result.upattern_count++;
-                }
-                break;
-            case STATE_OPTIONS:
-                if (docopt__str_isspace(line)) {
-                    state = STATE_START;
-                    break;
-                }
-                {
-                    Docopt__OPattern p = docopt__compile_opattern(line);
-                    // TODO: reallocate if capacity is exceeded
-                    assert(result.opattern_count < opattern_cap);
-                    result.opattern[result.opattern_count] = p;
-                    result.opattern_count++;
-                }
-                break;
+// The option key a usage element refers to, e.g. --speed for --speed=<kn>.
+Docopt__Short_String docopt__option_key(const char *name) {
+    const char *eq = strchr(name, '=');
+    return docopt__make_short_string(name, eq == NULL ? strlen(name) : (size_t) (eq - name));
+}
+
+const Docopt__OPattern *docopt__find_opattern(const Docopt__OPattern *opattern, size_t count, const char *key) {
+    for (size_t i=0; i<count; i++) {
+        for (size_t k=0; k<DOCOPT__OPTION_KEY_CAPACITY && opattern[i].key[k].it[0] != '\0'; k++) {
+            if (strcmp(opattern[i].key[k].it, key) == 0) return &opattern[i];
+        }
+    }
+    return NULL;
+}
+
+// The index of the key an option is reported by: its long form if it has one.
+size_t docopt__opattern_name_index(const Docopt__OPattern *o) {
+    for (size_t k=0; k<DOCOPT__OPTION_KEY_CAPACITY && o->key[k].it[0] != '\0'; k++) {
+        if (docopt__str_isprefix("--", o->key[k].it)) return k;
+    }
+    return 0;
+}
+
+Docopt__Short_String docopt__opattern_name(const Docopt__OPattern *o) {
+    return o->key[docopt__opattern_name_index(o)];
+}
+
+typedef struct {
+    Docopt__Arena *arena;
+    Docopt__Arena *scratch;
+    const Docopt__OPattern *opattern;
+    size_t opattern_count;
+    // while counting the leaves, leaf and follow are NULL
+    Docopt__Leaf *leaf;
+    size_t leaf_count;
+    size_t words;
+    uint64_t *follow;
+} Docopt__Automaton_Builder;
+
+typedef struct {
+    bool nullable;
+    uint64_t *first;
+    uint64_t *last;
+} Docopt__Glushkov;
+
+Docopt__Glushkov docopt__glushkov_empty(Docopt__Automaton_Builder *b, bool nullable) {
+    Docopt__Glushkov result;
+    result.nullable = nullable;
+    result.first = docopt__arena_alloc(b->scratch, b->words * sizeof(uint64_t));
+    result.last  = docopt__arena_alloc(b->scratch, b->words * sizeof(uint64_t));
+    return result;
+}
+
+Docopt__Glushkov docopt__glushkov_leaf(Docopt__Automaton_Builder *b, Docopt__Leaf leaf) {
+    Docopt__Glushkov result = docopt__glushkov_empty(b, false);
+    if (leaf.kind == DOCOPT__LEAF_COMMAND) {
+        leaf.hash[0] = docopt__hash(leaf.node->name.it, strlen(leaf.node->name.it));
+    } else if (leaf.kind == DOCOPT__LEAF_OPTION || leaf.kind == DOCOPT__LEAF_OPTION_KEY) {
+        const Docopt__Short_String *keys = leaf.option == NULL ? &leaf.key : leaf.option->key;
+        size_t key_count = leaf.option == NULL ? 1 : DOCOPT__OPTION_KEY_CAPACITY;
+        for (size_t k=0; k<key_count && keys[k].it[0] != '\0'; k++) {
+            leaf.hash[k] = docopt__hash(keys[k].it, strlen(keys[k].it));
         }
     }
+    if (b->leaf != NULL) {
+        b->leaf[b->leaf_count] = leaf;
+        docopt__set_add(result.first, b->leaf_count);
+        docopt__set_add(result.last,  b->leaf_count);
+    }
+    b->leaf_count++;
     return result;
 }
 
-void docopt__append_match(Docopt_Match *m, Docopt_Element_Kind kind, const char *key, const char *val) {
-    size_t n = m->count;
-    m->kind[n] = kind;
-    m->key[n] = key;
-    m->value[n] = val;
-    m->count++;
+void docopt__glushkov_link(Docopt__Automaton_Builder *b, const uint64_t *from, const uint64_t *to) {
+    if (b->follow == NULL) return;
+    for (size_t i = docopt__set_next(from, 0, b->leaf_count); i < b->leaf_count; i = docopt__set_next(from, i+1, b->leaf_count)) {
+        docopt__set_union(b->follow + i * b->words, to, b->words);
+    }
 }
 
-int docopt__umatch(Docopt__UPattern p, int argc, const char **argv, Docopt_Match *m) {
-    switch (p.kind) {
-        case DOCOPT__UPATTERN_ROOT:
-            {
-                if (argc == 0) return 0;
-                assert(argc > 0);
-                m->count = 0;
+Docopt__Glushkov docopt__glushkov_seq(Docopt__Automaton_Builder *b, Docopt__Glushkov x, Docopt__Glushkov y) {
+    docopt__glushkov_link(b, x.last, y.first);
+    Docopt__Glushkov result = docopt__glushkov_empty(b, x.nullable && y.nullable);
+    docopt__set_union(result.first, x.first, b->words);
+    if (x.nullable) docopt__set_union(result.first, y.first, b->words);
+    docopt__set_union(result.last, y.last, b->words);
+    if (y.nullable) docopt__set_union(result.last, x.last, b->words);
+    return result;
+}
+
+Docopt__Glushkov docopt__glushkov_alt(Docopt__Automaton_Builder *b, Docopt__Glushkov x, Docopt__Glushkov y) {
+    Docopt__Glushkov result = docopt__glushkov_empty(b, x.nullable || y.nullable);
+    docopt__set_union(result.first, x.first, b->words);
+    docopt__set_union(result.first, y.first, b->words);
+    docopt__set_union(result.last, x.last, b->words);
+    docopt__set_union(result.last, y.last, b->words);
+    return result;
+}
+
+Docopt__Glushkov docopt__glushkov_repeat(Docopt__Automaton_Builder *b, Docopt__Glushkov x) {
+    docopt__glushkov_link(b, x.last, x.first);
+    return x;
+}
+
+// An option either with its value attached or followed by its value.
+Docopt__Glushkov docopt__glushkov_option(Docopt__Automaton_Builder *b, const Docopt__UPattern *node, const Docopt__OPattern *o, Docopt__Short_String key) {
+    Docopt__Leaf leaf = {0};
+    leaf.kind = DOCOPT__LEAF_OPTION;
+    leaf.node = node;
+    leaf.option = o;
+    leaf.key = key;
+    leaf.bit = o == NULL ? 0 : (int) (o - b->opattern) + 1;
+    leaf.takes_value = (o != NULL && o->value.it[0] != '\0') || (node != NULL && strchr(node->name.it, '=') != NULL);
+    if (!leaf.takes_value) return docopt__glushkov_leaf(b, leaf);
+
+    Docopt__Glushkov attached = docopt__glushkov_leaf(b, leaf);
+    leaf.kind = DOCOPT__LEAF_OPTION_KEY;
+    Docopt__Glushkov k = docopt__glushkov_leaf(b, leaf);
+    leaf.kind = DOCOPT__LEAF_OPTION_VALUE;
+    Docopt__Glushkov v = docopt__glushkov_leaf(b, leaf);
+    Docopt__Glushkov separate = docopt__glushkov_seq(b, k, v);
+    return docopt__glushkov_alt(b, attached, separate);
+}
+
+// The [options] shortcut: any option of the Options section, any number of times.
+Docopt__Glushkov docopt__glushkov_options(Docopt__Automaton_Builder *b, const Docopt__UPattern *node) {
+    Docopt__Glushkov result = docopt__glushkov_empty(b, false);
+    for (size_t i=0; i<b->opattern_count; i++) {
+        const Docopt__OPattern *o = &b->opattern[i];
+        Docopt__Glushkov x = docopt__glushkov_option(b, node, o, docopt__opattern_name(o));
+        result = i == 0 ? x : docopt__glushkov_alt(b, result, x);
+    }
+    return docopt__glushkov_repeat(b, result);
+}
+
+Docopt__Glushkov docopt__glushkov_simple(Docopt__Automaton_Builder *b, const Docopt__UPattern *p) {
+    if (docopt__is_option(p->name.it)) {
+        Docopt__Short_String key = docopt__option_key(p->name.it);
+        const Docopt__OPattern *o = docopt__find_opattern(b->opattern, b->opattern_count, key.it);
+        return docopt__glushkov_option(b, p, o, o == NULL ? key : docopt__opattern_name(o));
+    }
+    Docopt__Leaf leaf = {0};
+    leaf.kind = docopt__is_argument(p->name.it) ? DOCOPT__LEAF_ARGUMENT : DOCOPT__LEAF_COMMAND;
+    leaf.node = p;
+    leaf.key = p->name;
+    return docopt__glushkov_leaf(b, leaf);
+}
 
-                assert(p.head->kind == DOCOPT__UPATTERN_SIMPLE);
-                docopt__append_match(m, DOCOPT_PROGRAM_NAME, strdup(p.head->name.it), argv[0]);
-                int n1 = 1;
+bool docopt__upattern_is_value_of(const Docopt__UPattern *p, const Docopt__UPattern *option, const Docopt__Automaton_Builder *b) {
+    if (p == NULL) return false;
+    // the value either starts a sequence or is the last element of the line itself
+    const Docopt__UPattern *value = p;
+    if (p->kind == DOCOPT__UPATTERN_GROUP) {
+        if (p->optional || p->alternative || p->repeat) return false;
+        value = p->head;
+    }
+    if (value->kind != DOCOPT__UPATTERN_SIMPLE || !docopt__is_argument(value->name.it)) return false;
+    if (option->kind != DOCOPT__UPATTERN_SIMPLE || !docopt__is_option(option->name.it)) return false;
+    if (strchr(option->name.it, '=') != NULL) return false;
+    const Docopt__OPattern *o = docopt__find_opattern(b->opattern, b->opattern_count, option->name.it);
+    return o != NULL && o->value.it[0] != '\0';
+}
 
-                int n2 = docopt__umatch(*p.rest, argc-1, argv+1, m);
-                return n1+n2;
+Docopt__Glushkov docopt__glushkov(Docopt__Automaton_Builder *b, const Docopt__UPattern *p) {
+    switch (p->kind) {
+        case DOCOPT__UPATTERN_ROOT:
+            {
+                assert(p->head->kind == DOCOPT__UPATTERN_SIMPLE);
+                Docopt__Leaf leaf = {0};
+                leaf.kind = DOCOPT__LEAF_PROGRAM;
+                leaf.node = p->head;
+                leaf.key = p->head->name;
+                Docopt__Glushkov result = docopt__glushkov_leaf(b, leaf);
+                if (p->rest == NULL) return result;
+                Docopt__Glushkov rest = docopt__glushkov(b, p->rest);
+                return docopt__glushkov_seq(b, result, rest);
             }
         case DOCOPT__UPATTERN_SIMPLE:
-            if (argc == 0) return 0;
-            assert(argc > 0);
-            if (docopt__is_option(p.name.it)) {
-                assert(0);
-            } else if (docopt__is_argument(p.name.it)) {
-                docopt__append_match(m, DOCOPT_ARGUMENT, strdup(p.name.it), argv[0]);
-                return 1;
-            } else {
-                if (strcmp(p.name.it, argv[0]) == 0) {
-                    docopt__append_match(m, DOCOPT_SUBCOMMAND, NULL, argv[0]);
-                    return 1;
-                }
-                return 0;
-            }
-            assert(0);
+            return docopt__glushkov_simple(b, p);
         case DOCOPT__UPATTERN_GROUP:
             {
-                assert(p.head != NULL);
-                if (p.optional) assert(0);
-                if (p.alternative) assert(0);
-                if (p.repeat) {
-                    if (p.rest == NULL) {
-                        int total = 0;
-                        int n = docopt__umatch(*p.head, argc, argv, m);
-                        if (n == 0) return 0;
-                        assert(n > 0);
-                        total += n;
-                        while (total <= argc && n > 0) {
-                            n = docopt__umatch(*p.head, argc-total, argv+total, m);
-                            assert(n >= 0);
-                            total += n;
-                        }
-                        return total;
+                assert(p->head != NULL);
+                Docopt__Glushkov result;
+                if (p->optional && p->rest == NULL && p->head->kind == DOCOPT__UPATTERN_SIMPLE && strcmp(p->head->name.it, "options") == 0) {
+                    result = docopt__glushkov_options(b, p->head);
+                } else if (p->alternative) {
+                    assert(p->rest != NULL);
+                    // the leaves are numbered in order, which is also their priority
+                    Docopt__Glushkov head = docopt__glushkov(b, p->head);
+                    Docopt__Glushkov rest = docopt__glushkov(b, p->rest);
+                    result = docopt__glushkov_alt(b, head, rest);
+                } else {
+                    result = docopt__glushkov(b, p->head);
+                    if (p->repeat) result = docopt__glushkov_repeat(b, result);
+                    const Docopt__UPattern *rest = p->rest;
+                    // -o FILE in a usage line is the option together with its value
+                    if (docopt__upattern_is_value_of(rest, p->head, b)) rest = rest->rest;
+                    if (rest != NULL) {
+                        Docopt__Glushkov tail = docopt__glushkov(b, rest);
+                        result = docopt__glushkov_seq(b, result, tail);
                     }
-                    assert(0);
-                }
-                int n1 = docopt__umatch(*p.head, argc, argv, m);
-                assert(n1 > 0);
-                assert(n1 <= argc);
-                if (p.rest != NULL) {
-                    int n2 = docopt__umatch(*p.rest, argc-n1, argv+n1, m);
-                    return n1 + n2;
                 }
-                return n1;
+                if (p->optional) result.nullable = true;
+                return result;
             }
         case DOCOPT__UPATTERN_KIND_COUNT:
             assert(0);
@@ -433,42 +1104,2808 @@ int docopt__umatch(Docopt__UPattern p, int argc, const char **argv, Docopt_Match
     assert(0);
 }
 
-Docopt_Match docopt__match(Docopt__Pattern p, int argc, const char **argv) {
-    Docopt_Match m;
-    assert(argc > 0);
-    m.kind  = calloc(argc, sizeof(m.kind[0]));
-    m.key   = calloc(argc, sizeof(m.key[0]));
-    m.value = calloc(argc, sizeof(m.value[0]));
-    for (size_t i=0; i<p.upattern_count; i++) {
-        if (docopt__umatch(p.upattern[i], argc, argv, &m) == argc) break;
-    }
-    for (int i=0; i<m.count; i++) {
-        if (m.kind[i] == DOCOPT_OPTION) {
-            assert(0);
+// Whether both options are spelled alike: the same key, both with or without a value attached.
+bool docopt__options_overlap(const Docopt__Leaf *x, const Docopt__Leaf *y) {
+    bool x_attached = x->kind == DOCOPT__LEAF_OPTION && x->takes_value;
+    bool y_attached = y->kind == DOCOPT__LEAF_OPTION && y->takes_value;
+    if (x_attached != y_attached) return false;
+    const Docopt__Short_String *x_keys = x->option == NULL ? &x->key : x->option->key;
+    const Docopt__Short_String *y_keys = y->option == NULL ? &y->key : y->option->key;
+    size_t x_count = x->option == NULL ? 1 : DOCOPT__OPTION_KEY_CAPACITY;
+    size_t y_count = y->option == NULL ? 1 : DOCOPT__OPTION_KEY_CAPACITY;
+    for (size_t i=0; i<x_count && x_keys[i].it[0] != '\0'; i++) {
+        for (size_t j=0; j<y_count && y_keys[j].it[0] != '\0'; j++) {
+            if (strcmp(x_keys[i].it, y_keys[j].it) == 0) return true;
         }
     }
-    return m;
+    return false;
 }
 
-Docopt_Match docopt_interpret(const char *help, int argc, const char **argv) {
-    Docopt__Pattern p = docopt__compile_pattern(help);
-    return docopt__match(p, argc, argv);
-    //TODO: free the memory allocated by docopt__compile_pattern
+// Whether two leaves may consume the same element of argv. Options never
+// consume what commands and arguments do.
+bool docopt__leaves_overlap(const Docopt__Leaf *x, const Docopt__Leaf *y) {
+    if (x->kind == DOCOPT__LEAF_OPTION_VALUE || y->kind == DOCOPT__LEAF_OPTION_VALUE) return true;
+    if (x->kind == DOCOPT__LEAF_PROGRAM || y->kind == DOCOPT__LEAF_PROGRAM) return true;
+    bool x_option = x->kind == DOCOPT__LEAF_OPTION || x->kind == DOCOPT__LEAF_OPTION_KEY;
+    bool y_option = y->kind == DOCOPT__LEAF_OPTION || y->kind == DOCOPT__LEAF_OPTION_KEY;
+    if (x_option != y_option) return false;
+    if (x_option) return docopt__options_overlap(x, y);
+    if (x->kind == DOCOPT__LEAF_ARGUMENT || y->kind == DOCOPT__LEAF_ARGUMENT) return true;
+    return strcmp(x->node->name.it, y->node->name.it) == 0;
 }
 
-#endif // DOCOPT_IMPLEMENTATION
+bool docopt__automaton_is_ll1(const Docopt__Automaton *a) {
+    size_t n = a->leaf_count;
+    for (size_t q=0; q<n; q++) {
+        const uint64_t *follow = docopt__automaton_follow(a, q);
+        for (size_t i = docopt__set_next(follow, 0, n); i < n; i = docopt__set_next(follow, i+1, n)) {
+            for (size_t j = docopt__set_next(follow, i+1, n); j < n; j = docopt__set_next(follow, j+1, n)) {
+                if (docopt__leaves_overlap(&a->leaf[i], &a->leaf[j])) return false;
+            }
+        }
+    }
+    return true;
+}
 
-#ifdef DOCOPT_UTILITY
+// The options of the [options] shortcut repeat by the shortcut, not by their key:
+// as with docopt they are neither repeated nor repeat the options of the line.
+bool docopt__leaf_is_shortcut(const Docopt__Leaf *leaf) {
+    if (leaf->kind != DOCOPT__LEAF_OPTION && leaf->kind != DOCOPT__LEAF_OPTION_KEY) return false;
+    return leaf->node != NULL && strcmp(leaf->node->name.it, "options") == 0;
+}
 
-#include <stdio.h>
+// Whether a leaf with the key of leaf l is reachable from l, reach has room for the set.
+bool docopt__automaton_repeats(const Docopt__Automaton *a, size_t l, uint64_t *reach) {
+    const Docopt__Leaf *leaf = &a->leaf[l];
+    if (leaf->kind == DOCOPT__LEAF_PROGRAM || leaf->kind == DOCOPT__LEAF_OPTION_VALUE) return false;
+    if (docopt__leaf_is_shortcut(leaf)) return false;
+    size_t n = a->leaf_count;
+    memcpy(reach, docopt__automaton_follow(a, l), a->words * sizeof(uint64_t));
+    for (bool grown = true; grown;) {
+        grown = false;
+        for (size_t q = docopt__set_next(reach, 0, n); q < n; q = docopt__set_next(reach, q+1, n)) {
+            const uint64_t *follow = docopt__automaton_follow(a, q);
+            for (size_t w=0; w<a->words; w++) {
+                if ((follow[w] & ~reach[w]) == 0) continue;
+                reach[w] |= follow[w];
+                grown = true;
+            }
+        }
+    }
+    for (size_t q = docopt__set_next(reach, 0, n); q < n; q = docopt__set_next(reach, q+1, n)) {
+        const Docopt__Leaf *other = &a->leaf[q];
+        if (other->kind == DOCOPT__LEAF_OPTION_VALUE || docopt__leaf_is_shortcut(other)) continue;
+        if (strcmp(other->key.it, leaf->key.it) == 0) return true;
+    }
+    return false;
+}
+
+Docopt__Automaton docopt__compile_automaton(Docopt__Arena *arena, const Docopt__UPattern *root, const Docopt__OPattern *opattern, size_t opattern_count) {
+    Docopt__Arena scratch = {0};
+    Docopt__Automaton_Builder b = {0};
+    b.arena = arena;
+    b.scratch = &scratch;
+    b.opattern = opattern;
+    b.opattern_count = opattern_count;
+
+    // first count the leaves to know the size of the sets
+    docopt__glushkov(&b, root);
+    size_t leaf_count = b.leaf_count;
+
+    b.leaf_count = 0;
+    b.words = DOCOPT__SET_WORDS(leaf_count);
+    b.leaf = docopt__arena_alloc(arena, leaf_count * sizeof(Docopt__Leaf));
+    b.follow = docopt__arena_alloc(arena, leaf_count * b.words * sizeof(uint64_t));
+    Docopt__Glushkov g = docopt__glushkov(&b, root);
+    assert(b.leaf_count == leaf_count);
+
+    Docopt__Automaton result = {0};
+    result.leaf_count = leaf_count;
+    result.leaf = b.leaf;
+    result.words = b.words;
+    result.follow = b.follow;
+    uint64_t *last = docopt__arena_alloc(arena, b.words * sizeof(uint64_t));
+    memcpy(last, g.last, b.words * sizeof(uint64_t));
+    result.last = last;
+    result.ll1 = docopt__automaton_is_ll1(&result);
+    uint64_t *reach = docopt__arena_alloc(&scratch, b.words * sizeof(uint64_t));
+    for (size_t l=0; l<leaf_count; l++) {
+        b.leaf[l].repeats = docopt__automaton_repeats(&result, l, reach);
+    }
+
+    docopt__arena_free(&scratch);
+    return result;
+}
+
+// The value attached to an option in arg (--speed=10, -ofile), NULL if arg is not the option.
+const char *docopt__leaf_attached_value(const Docopt__Leaf *leaf, const char *arg) {
+    if (!docopt__is_option(arg)) return NULL;
+    const Docopt__Short_String *keys = leaf->option == NULL ? &leaf->key : leaf->option->key;
+    size_t key_count = leaf->option == NULL ? 1 : DOCOPT__OPTION_KEY_CAPACITY;
+    for (size_t k=0; k<key_count && keys[k].it[0] != '\0'; k++) {
+        const char *key = keys[k].it;
+        if (!docopt__str_isprefix(key, arg)) continue;
+        size_t n = strlen(key);
+        if (docopt__str_isprefix("--", key)) {
+            if (arg[n] == '=') return arg + n + 1;
+        } else {
+            if (arg[n] != '\0') return arg + n;
+        }
+    }
+    return NULL;
+}
+
+typedef enum {
+    DOCOPT__TOKEN_POSITIONAL,
+    DOCOPT__TOKEN_LONG,
+    DOCOPT__TOKEN_SHORT,
+    DOCOPT__TOKEN_DASH,
+    DOCOPT__TOKEN_DASHDASH,
+} Docopt__Token_Kind;
+
+// An element of argv classified once before matching, such that the leaves
+// do not scan it again. Options are split into the name and the value
+// attached to it: --speed=10 has the name --speed, -ofile the name -o.
+// The name of any other element is the element itself. The short options
+// of a stack like -vq are a token each with the index of the stack in argv.
+typedef struct {
+    Docopt__Token_Kind kind;
+    const char *arg;
+    size_t name_length;
+    uint64_t hash;
+    const char *value;
+    int index;
+} Docopt__Token;
+
+Docopt__Token docopt__classify(const char *arg) {
+    Docopt__Token t = {0};
+    t.arg = arg;
+    if (arg[0] != '-') {
+        t.kind = DOCOPT__TOKEN_POSITIONAL;
+        t.name_length = strlen(arg);
+    } else if (arg[1] == '\0') {
+        t.kind = DOCOPT__TOKEN_DASH;
+        t.name_length = 1;
+    } else if (arg[1] != '-') {
+        t.kind = DOCOPT__TOKEN_SHORT;
+        t.name_length = 2;
+        if (arg[2] != '\0') t.value = arg + 2;
+    } else if (arg[2] == '\0') {
+        t.kind = DOCOPT__TOKEN_DASHDASH;
+        t.name_length = 2;
+    } else {
+        t.kind = DOCOPT__TOKEN_LONG;
+        const char *eq = strchr(arg, '=');
+        t.name_length = eq == NULL ? strlen(arg) : (size_t) (eq - arg);
+        if (eq != NULL) t.value = eq + 1;
+    }
+    t.hash = docopt__hash(arg, t.name_length);
+    return t;
+}
+
+bool docopt__token_is_option(const Docopt__Token *t) {
+    return t->kind == DOCOPT__TOKEN_LONG || t->kind == DOCOPT__TOKEN_SHORT;
+}
+
+// The elements of argv classified on demand, in order, such that a tail that
+// is passed through is never looked at. The elements after token[positional]
+// are positional whatever they look like. With a pattern, the single pass over
+// argv also finds that element, which ends the options, and expands the stacked
+// short options before it, growing token in arena as needed.
+typedef struct {
+    const char **argv;
+    int argc;
+    Docopt__Token *token;
+    int capacity;
+    // the number of tokens classified and the element of argv they end before
+    int classified;
+    int next;
+    int positional;
+    // set while the next element is the value of an option
+    bool value;
+    const struct Docopt__Pattern *pattern;
+    Docopt__Arena *arena;
+} Docopt__Tokens;
+
+int docopt__expand_short(const struct Docopt__Pattern *p, const char *arg, const char **out);
+bool docopt__ends_options(const struct Docopt__Pattern *p, const char *arg, bool *value);
+
+// The tokens of argv for matching it against p. Without an arena the tokens are
+// only counted, see docopt__tokens_count.
+Docopt__Tokens docopt__tokens(const struct Docopt__Pattern *p, int argc, const char **argv, Docopt__Arena *arena) {
+    Docopt__Tokens result = {.argv = argv, .argc = argc, .positional = INT_MAX, .pattern = p, .arena = arena};
+    if (arena != NULL) {
+        result.token = docopt__arena_alloc(arena, argc * sizeof(Docopt__Token));
+        result.capacity = argc;
+    }
+    return result;
+}
+
+void docopt__tokens_reserve(Docopt__Tokens *t, int count) {
+    if (t->arena == NULL || count <= t->capacity) return;
+    // doubled such that docopt__match_size can tell the sizes from the count
+    int capacity = t->capacity;
+    while (capacity < count) capacity *= 2;
+    Docopt__Token *token = docopt__arena_alloc(t->arena, capacity * sizeof(Docopt__Token));
+    memcpy(token, t->token, t->classified * sizeof(Docopt__Token));
+    t->token = token;
+    t->capacity = capacity;
+}
+
+const Docopt__Token *docopt__token(Docopt__Tokens *t, int i) {
+    while (t->classified <= i) {
+        const char *piece[DOCOPT_SHORT_STRLEN];
+        piece[0] = t->argv[t->next];
+        int n = 1;
+        if (t->pattern != NULL && t->next > 0 && t->classified < t->positional) {
+            if (docopt__ends_options(t->pattern, piece[0], &t->value)) {
+                t->positional = t->classified;
+            } else {
+                n = docopt__expand_short(t->pattern, piece[0], piece);
+            }
+        }
+        docopt__tokens_reserve(t, t->classified + n);
+        for (int k=0; k<n && t->token != NULL; k++) {
+            Docopt__Token *token = &t->token[t->classified + k];
+            *token = docopt__classify(piece[k]);
+            token->index = t->next;
+            if (t->classified + k > t->positional) token->kind = DOCOPT__TOKEN_POSITIONAL;
+        }
+        t->classified += n;
+        t->next++;
+    }
+    return t->token == NULL ? NULL : &t->token[i];
+}
+
+// The number of elements of argv once its stacks are expanded. Classifies the
+// elements up to the one that ends the options, the ones after it stay as they are.
+int docopt__tokens_count(Docopt__Tokens *t) {
+    while (t->next < t->argc && t->classified <= t->positional) docopt__token(t, t->classified);
+    int count = t->classified + t->argc - t->next;
+    docopt__tokens_reserve(t, count);
+    return count;
+}
+
+// The i-th element of argv once its stacks are expanded, and where its values
+// start in argv; argv is already expanded if token is NULL. Only stacks are
+// expanded, such that the elements of a repeated argument are consecutive in argv.
+const char *docopt__element(const char **argv, const Docopt__Token *token, int i) {
+    return token == NULL ? argv[i] : token[i].arg;
+}
+
+const char **docopt__element_values(const char **argv, const Docopt__Token *token, int i) {
+    return token == NULL ? &argv[i] : &argv[token[i].index];
+}
+
+// Whether the option t is one of the keys of leaf, with or without a value attached.
+// The strings are only compared if the hashes agree.
+bool docopt__leaf_has_key(const Docopt__Leaf *leaf, const Docopt__Token *t, bool attached) {
+    if (!docopt__token_is_option(t) || (t->value != NULL) != attached) return false;
+    const Docopt__Short_String *keys = leaf->option == NULL ? &leaf->key : leaf->option->key;
+    for (size_t k=0; k<DOCOPT__OPTION_KEY_CAPACITY && leaf->hash[k] != 0; k++) {
+        if (leaf->hash[k] != t->hash) continue;
+        const char *key = keys[k].it;
+        if (strncmp(key, t->arg, t->name_length) == 0 && key[t->name_length] == '\0') return true;
+    }
+    return false;
+}
+
+bool docopt__leaf_matches(const Docopt__Leaf *leaf, const Docopt__Token *t) {
+    switch (leaf->kind) {
+        case DOCOPT__LEAF_PROGRAM:
+            return true;
+        case DOCOPT__LEAF_COMMAND:
+            return !docopt__token_is_option(t) && leaf->hash[0] == t->hash && strcmp(leaf->node->name.it, t->arg) == 0;
+        case DOCOPT__LEAF_ARGUMENT:
+            return !docopt__token_is_option(t);
+        case DOCOPT__LEAF_OPTION:
+            return docopt__leaf_has_key(leaf, t, leaf->takes_value);
+        case DOCOPT__LEAF_OPTION_KEY:
+            return docopt__leaf_has_key(leaf, t, false);
+        case DOCOPT__LEAF_OPTION_VALUE:
+            return true;
+        case DOCOPT__LEAF_KIND_COUNT:
+            assert(0);
+    }
+    assert(0);
+}
+
+// Advances the frontier from, the leaves that may have consumed the previous
+// element of argv, by t into to. If pred is not NULL, pred[i] receives the
+// leaf leaf i followed. Returns false if no leaf consumes t.
+bool docopt__automaton_step(const Docopt__Automaton *a, const uint64_t *from, const Docopt__Token *t, uint64_t *to, int *pred) {
+    memset(to, 0, a->words * sizeof(uint64_t));
+    bool result = false;
+    size_t n = a->leaf_count;
+    for (size_t q = docopt__set_next(from, 0, n); q < n; q = docopt__set_next(from, q+1, n)) {
+        const uint64_t *follow = docopt__automaton_follow(a, q);
+        for (size_t l = docopt__set_next(follow, 0, n); l < n; l = docopt__set_next(follow, l+1, n)) {
+            if (docopt__set_has(to, l)) continue;
+            if (!docopt__leaf_matches(&a->leaf[l], t)) continue;
+            docopt__set_add(to, l);
+            if (pred != NULL) pred[l] = q;
+            result = true;
+        }
+    }
+    return result;
+}
+
+// The commands the usage lines start with, merged into a tree such that
+// docopt__match compares each of them once however many lines share it.
+// Node 0 is the root, the program name.
+typedef struct {
+    Docopt__Short_String command;
+    uint64_t hash;
+    int parent;
+    // 1 + the index of the first child and of the next sibling, 0 if there is none
+    int child;
+    int sibling;
+} Docopt__Prefix;
+
+typedef enum {
+    DOCOPT__USAGE_PENDING,
+    DOCOPT__USAGE_COMPILING,
+    DOCOPT__USAGE_COMPILED,
+} Docopt__Usage_State;
+
+// A usage line of a compiled help message is only compiled by
+// docopt__pattern_usage when the matcher first needs it.
+// Until then the line is known by its code and its leading commands,
+// the node prefix in the tree of leading commands at depth prefix_length.
+// Threads may match with the same pattern: state is only changed atomically,
+// upattern and automaton are only read once it is DOCOPT__USAGE_COMPILED.
+typedef struct {
+    const char *code;
+    int prefix;
+    int prefix_length;
+    _Atomic int state;
+    const Docopt__UPattern *upattern;
+    const Docopt__Automaton *automaton;
+    Docopt__Arena arena;
+} Docopt__Usage;
+
+// A key of the JSON of a match: the bit of an option, whether the key has a
+// value and whether it may be given more than once.
+typedef struct {
+    const char *key;
+    int bit;
+    bool valued;
+    bool repeats;
+} Docopt__Key;
+
+// The keys of a pattern in the order the JSON of its matches lists them. They
+// are collected by docopt__pattern_keys the first time a match is written and
+// go through the states of a usage line; emitted patterns come with them.
+typedef struct {
+    _Atomic int state;
+    size_t count;
+    const Docopt__Key *key;
+    Docopt__Arena arena;
+} Docopt__Keys;
+
+// A pattern either has all its usage lines compiled in upattern and automaton
+// (as emitted by docopt__emit_pattern) or an index of usage lines in usage.
+typedef struct Docopt__Pattern {
+    size_t upattern_count;
+    const Docopt__UPattern *upattern;
+    const Docopt__Automaton *automaton;
+    Docopt__Usage *usage;
+    Docopt__Prefix *prefix;
+    size_t opattern_count;
+    const Docopt__OPattern *opattern;
+    // short_option[c] is 1 + the index of the option -c in opattern, 0 if there is none
+    const unsigned char *short_option;
+    // option_key[i] is the key the i-th option is reported by
+    const char *const *option_key;
+    // option_default[i] is the default of the i-th option, NULL if no option has one
+    const Docopt_Value *option_default;
+    // whether option_default holds the environment variables of the options
+    // as of docopt_compile, otherwise every match reads them
+    bool environment;
+    int flags;
+    Docopt__Keys *keys;
+    Docopt__Arena arena;
+} Docopt__Pattern;
+
+// The next of the commands a usage line starts with after the program name,
+// such that the line can be skipped for other commands without compiling it.
+// Each is required and followed by the next, so once argv starts with them
+// a single leaf of the line is left. Returns false after the last one.
+bool docopt__usage_command(const char **code, Docopt__Short_String *command) {
+    const char *rest = *code;
+    Docopt__Short_String word = docopt__word(&rest);
+    if (word.it[0] == '\0' || word.it[0] == '-') return false;
+    if (strchr("[]()|", word.it[0]) != NULL) return false;
+    if (strcmp("...", word.it) == 0) return false;
+    if (docopt__is_argument(word.it)) return false;
+    const char *after = rest;
+    Docopt__Short_String next = docopt__word(&after);
+    if (strcmp("|", next.it) == 0 || strcmp("...", next.it) == 0) return false;
+    *code = rest;
+    *command = word;
+    return true;
+}
+
+// The node below parent for command, added if there is none yet.
+int docopt__prefix_child(Docopt__Prefix *prefix, size_t *count, int parent, Docopt__Short_String command) {
+    int *link = &prefix[parent].child;
+    while (*link != 0) {
+        if (strcmp(prefix[*link-1].command.it, command.it) == 0) return *link-1;
+        link = &prefix[*link-1].sibling;
+    }
+    Docopt__Prefix *node = &prefix[*count];
+    node->command = command;
+    node->hash = docopt__hash(command.it, strlen(command.it));
+    node->parent = parent;
+    node->child = 0;
+    node->sibling = 0;
+    (*count)++;
+    *link = *count;
+    return *count-1;
+}
+
+// Merges the leading commands of the usage lines into p->prefix.
+void docopt__pattern_prefix(Docopt__Pattern *p) {
+    // at most one node per leading command, fewer where lines share them
+    size_t capacity = 1;
+    for (size_t i=0; i<p->upattern_count; i++) {
+        const char *code = p->usage[i].code;
+        docopt__word(&code);
+        Docopt__Short_String command;
+        while (docopt__usage_command(&code, &command)) capacity++;
+    }
+    Docopt__Prefix *prefix = docopt__arena_alloc(&p->arena, capacity * sizeof(Docopt__Prefix));
+    memset(&prefix[0], 0, sizeof(Docopt__Prefix));
+    size_t count = 1;
+    for (size_t i=0; i<p->upattern_count; i++) {
+        Docopt__Usage *u = &p->usage[i];
+        const char *code = u->code;
+        docopt__word(&code);
+        Docopt__Short_String command;
+        u->prefix = 0;
+        u->prefix_length = 0;
+        while (docopt__usage_command(&code, &command)) {
+            u->prefix = docopt__prefix_child(prefix, &count, u->prefix, command);
+            u->prefix_length++;
+        }
+    }
+    assert(count <= capacity);
+    p->prefix = prefix;
+}
+
+// Compiles the i-th usage line the first time it is asked for. The first
+// thread to ask compiles it, threads asking meanwhile wait for it.
+const Docopt__Usage *docopt__pattern_usage(const Docopt__Pattern *p, size_t i) {
+    Docopt__Usage *u = &p->usage[i];
+    if (atomic_load_explicit(&u->state, memory_order_acquire) == DOCOPT__USAGE_COMPILED) return u;
+    int pending = DOCOPT__USAGE_PENDING;
+    if (!atomic_compare_exchange_strong_explicit(&u->state, &pending, DOCOPT__USAGE_COMPILING, memory_order_acquire, memory_order_acquire)) {
+        while (atomic_load_explicit(&u->state, memory_order_acquire) != DOCOPT__USAGE_COMPILED) sched_yield();
+        return u;
+    }
+    Docopt__UPattern *root = docopt__arena_alloc(&u->arena, sizeof(Docopt__UPattern));
+    Docopt__UPattern parsed = docopt__compile_upattern(&u->arena, u->code);
+    *root = docopt__simplify_upattern(&u->arena, &parsed);
+    u->upattern = root;
+    Docopt__Automaton *a = docopt__arena_alloc(&u->arena, sizeof(Docopt__Automaton));
+    *a = docopt__compile_automaton(&u->arena, root, p->opattern, p->opattern_count);
+    u->automaton = a;
+    atomic_store_explicit(&u->state, DOCOPT__USAGE_COMPILED, memory_order_release);
+    return u;
+}
+
+const Docopt__UPattern *docopt__pattern_upattern(const Docopt__Pattern *p, size_t i) {
+    assert(i < p->upattern_count);
+    if (p->usage == NULL) return &p->upattern[i];
+    return docopt__pattern_usage(p, i)->upattern;
+}
+
+const Docopt__Automaton *docopt__pattern_automaton(const Docopt__Pattern *p, size_t i) {
+    assert(i < p->upattern_count);
+    if (p->usage == NULL) {
+        assert(p->automaton != NULL);
+        return &p->automaton[i];
+    }
+    return docopt__pattern_usage(p, i)->automaton;
+}
+
+Docopt__Key *docopt__find_key(Docopt__Key *key, size_t count, const char *name) {
+    for (size_t i=0; i<count; i++) {
+        if (strcmp(key[i].key, name) == 0) return &key[i];
+    }
+    return NULL;
+}
+
+// Collects the keys of the usage lines, in their order, and then of the Options
+// section the first time it is asked for, like docopt__pattern_usage. A key
+// repeats if any leaf with it repeats; the [options] shortcut does not repeat.
+const Docopt__Keys *docopt__pattern_keys(const Docopt__Pattern *p) {
+    Docopt__Keys *k = p->keys;
+    assert(k != NULL);
+    if (atomic_load_explicit(&k->state, memory_order_acquire) == DOCOPT__USAGE_COMPILED) return k;
+    int pending = DOCOPT__USAGE_PENDING;
+    if (!atomic_compare_exchange_strong_explicit(&k->state, &pending, DOCOPT__USAGE_COMPILING, memory_order_acquire, memory_order_acquire)) {
+        while (atomic_load_explicit(&k->state, memory_order_acquire) != DOCOPT__USAGE_COMPILED) sched_yield();
+        return k;
+    }
+    size_t capacity = p->opattern_count;
+    for (size_t i=0; i<p->upattern_count; i++) capacity += docopt__pattern_automaton(p, i)->leaf_count;
+    Docopt__Key *key = docopt__arena_alloc(&k->arena, capacity * sizeof(Docopt__Key));
+    size_t count = 0;
+    for (size_t i=0; i<p->upattern_count; i++) {
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, i);
+        for (size_t l=1; l<a->leaf_count; l++) {
+            const Docopt__Leaf *leaf = &a->leaf[l];
+            Docopt__Key *found = docopt__find_key(key, count, leaf->key.it);
+            if (found != NULL) {
+                found->repeats |= leaf->repeats;
+            } else if (leaf->kind != DOCOPT__LEAF_OPTION_VALUE) {
+                bool valued = leaf->kind == DOCOPT__LEAF_ARGUMENT || leaf->takes_value;
+                key[count++] = (Docopt__Key) {leaf->key.it, leaf->bit, valued, leaf->repeats};
+            }
+        }
+    }
+    for (size_t b=0; b<p->opattern_count; b++) {
+        if (docopt__find_key(key, count, p->option_key[b]) != NULL) continue;
+        key[count++] = (Docopt__Key) {p->option_key[b], (int) b + 1, p->opattern[b].value.it[0] != '\0', false};
+    }
+    k->key = key;
+    k->count = count;
+    atomic_store_explicit(&k->state, DOCOPT__USAGE_COMPILED, memory_order_release);
+    return k;
+}
+
+// Walks the leading commands of argv down the tree of leading commands.
+// walk[d] receives the node reached after d commands, walk needs room for
+// argc entries. Returns the number of commands walked.
+int docopt__pattern_walk(const Docopt__Pattern *p, int argc, Docopt__Tokens *token, int *walk) {
+    walk[0] = 0;
+    if (p->prefix == NULL) return 0;
+    int depth = 0;
+    while (depth+1 < argc) {
+        const Docopt__Token *t = docopt__token(token, depth+1);
+        if (t->kind != DOCOPT__TOKEN_POSITIONAL) break;
+        int child = p->prefix[walk[depth]].child;
+        while (child != 0) {
+            const Docopt__Prefix *node = &p->prefix[child-1];
+            if (node->hash == t->hash && strcmp(node->command.it, t->arg) == 0) break;
+            child = node->sibling;
+        }
+        if (child == 0) break;
+        depth++;
+        walk[depth] = child-1;
+    }
+    return depth;
+}
+
+// Whether the i-th usage line may match argv judging by its leading commands alone,
+// given the walk of argv by docopt__pattern_walk. If more is set, the walk ended
+// with argv so far and the line may start with more commands than argv has yet.
+bool docopt__pattern_is_candidate(const Docopt__Pattern *p, size_t i, const int *walk, int depth, bool more) {
+    if (p->usage == NULL) return true;
+    const Docopt__Usage *u = &p->usage[i];
+    if (u->prefix_length <= depth) return walk[u->prefix_length] == u->prefix;
+    if (!more) return false;
+    int node = u->prefix;
+    for (int d = u->prefix_length; d > depth; d--) node = p->prefix[node].parent;
+    return walk[depth] == node;
+}
+
+// The number of elements after the program name the walk of argv has
+// matched for the i-th usage line.
+int docopt__pattern_prefix_length(const Docopt__Pattern *p, size_t i) {
+    return p->usage == NULL ? 0 : p->usage[i].prefix_length;
+}
+
+Docopt__Pattern docopt__compile_pattern(const char *msg) {
+    Docopt__Pattern result = {0};
+    size_t usage_cap = 16;
+    size_t opattern_cap = 16;
+    Docopt__Usage *usage = docopt__arena_alloc(&result.arena, usage_cap * sizeof(Docopt__Usage));
+    Docopt__OPattern *opattern = docopt__arena_alloc(&result.arena, opattern_cap * sizeof(Docopt__OPattern));
+    result.usage = usage;
+    result.opattern = opattern;
+    result.keys = docopt__arena_alloc(&result.arena, sizeof(Docopt__Keys));
+
+    char *msg_cpy = docopt__arena_strdup(&result.arena, msg);
+
+    enum {
+        STATE_START,
+        STATE_USAGE,
+        STATE_OPTIONS,
+    } state = STATE_START;
+
+    for (const char *line = docopt__parse_line(msg_cpy); line; line = docopt__parse_line(NULL)) {
+        switch (state) {
+            case STATE_START:
+                if (docopt__str_isprefix("Usage:", line)) {
+                    state = STATE_USAGE;
+                    line += strlen("Usage:");
+                    if (docopt__str_isspace(line)) break;
+                    // the first usage line is on the same line
+                } else {
+                    if (docopt__str_isprefix("Options:", line)) {
+                        state = STATE_OPTIONS;
+                    }
+                    break;
+                }
+                // fallthrough
+            case STATE_USAGE:
+                if (docopt__str_isspace(line)) {
+                    state = STATE_START;
+                    break;
+                }
+                // TODO: reallocate if capacity is exceeded
+                assert(result.upattern_count < usage_cap);
+                usage[result.upattern_count].code = line;
+                result.upattern_count++;
+                break;
+            case STATE_OPTIONS:
+                if (docopt__str_isspace(line)) {
+                    state = STATE_START;
+                    break;
+                }
+                {
+                    Docopt__OPattern p = docopt__compile_opattern(line);
+                    // TODO: reallocate if capacity is exceeded
+                    assert(result.opattern_count < opattern_cap);
+                    opattern[result.opattern_count] = p;
+                    result.opattern_count++;
+                }
+                break;
+        }
+    }
+    docopt__pattern_prefix(&result);
+    if (result.opattern_count > 0) {
+        unsigned char *short_option = docopt__arena_alloc(&result.arena, 256);
+        for (size_t i=0; i<result.opattern_count; i++) {
+            for (size_t k=0; k<DOCOPT__OPTION_KEY_CAPACITY && opattern[i].key[k].it[0] != '\0'; k++) {
+                const char *key = opattern[i].key[k].it;
+                if (key[1] == '-' || key[1] == '\0' || key[2] != '\0') continue;
+                assert(i < 255);
+                short_option[(unsigned char) key[1]] = i + 1;
+            }
+        }
+        result.short_option = short_option;
+
+        const char **option_key = docopt__arena_alloc(&result.arena, result.opattern_count * sizeof(const char *));
+        for (size_t i=0; i<result.opattern_count; i++) {
+            option_key[i] = opattern[i].key[docopt__opattern_name_index(&opattern[i])].it;
+        }
+        result.option_key = option_key;
+
+        Docopt_Value *option_default = NULL;
+        for (size_t i=0; i<result.opattern_count; i++) {
+            if (opattern[i].def_value.kind == DOCOPT_VALUE_NONE) continue;
+            if (option_default == NULL) option_default = docopt__arena_alloc(&result.arena, result.opattern_count * sizeof(Docopt_Value));
+            option_default[i] = opattern[i].def_value;
+            option_default[i].string = opattern[i].def.it;
+        }
+        result.option_default = option_default;
+    }
+    return result;
+}
+
+// The option -c, NULL if there is none.
+const Docopt__OPattern *docopt__short_option(const Docopt__Pattern *p, char c) {
+    if (p->short_option == NULL) return NULL;
+    unsigned char i = p->short_option[(unsigned char) c];
+    return i == 0 ? NULL : &p->opattern[i-1];
+}
+
+const char *docopt__short_key(const Docopt__OPattern *o, char c) {
+    for (size_t k=0; k<DOCOPT__OPTION_KEY_CAPACITY && o->key[k].it[0] != '\0'; k++) {
+        if (o->key[k].it[1] == c && o->key[k].it[2] == '\0') return o->key[k].it;
+    }
+    assert(0);
+}
+
+// Stacked short options: -vq is -v -q, -ofile and -vofile end in -o file if -o
+// takes a value. Stores the elements arg stands for in out, which has room for
+// DOCOPT_SHORT_STRLEN of them, and returns their number: keys of the pattern
+// and the rest of arg, nothing is copied. Returns 1 with out[0] = arg if arg
+// is no stack of known short options, or of more options than fit.
+int docopt__expand_short(const Docopt__Pattern *p, const char *arg, const char **out) {
+    out[0] = arg;
+    if (arg[0] != '-' || arg[1] == '-' || arg[1] == '\0' || arg[2] == '\0') return 1;
+    int count = 0;
+    for (const char *c = arg+1; *c != '\0'; c++) {
+        const Docopt__OPattern *o = docopt__short_option(p, *c);
+        if (o == NULL || count+2 > DOCOPT_SHORT_STRLEN) {
+            out[0] = arg;
+            return 1;
+        }
+        out[count] = docopt__short_key(o, *c);
+        count++;
+        if (o->value.it[0] != '\0') {
+            if (c[1] == '\0') break;
+            out[count] = c+1;
+            count++;
+            break;
+        }
+    }
+    return count;
+}
+
+// Whether the option arg is followed by its value as the next element of argv.
+bool docopt__option_takes_next(const Docopt__Pattern *p, const char *arg) {
+    if (docopt__str_isprefix("--", arg)) {
+        if (strchr(arg, '=') != NULL) return false;
+        const Docopt__OPattern *o = docopt__find_opattern(p->opattern, p->opattern_count, arg);
+        return o != NULL && o->value.it[0] != '\0';
+    }
+    for (const char *c = arg+1; *c != '\0'; c++) {
+        const Docopt__OPattern *o = docopt__short_option(p, *c);
+        if (o == NULL) return false;
+        if (o->value.it[0] != '\0') return c[1] == '\0';
+    }
+    return false;
+}
+
+// Whether arg ends the options of argv, such that the elements after it are
+// positional: the element --, with options first the first positional element.
+// value is set while the next element is the value of an option.
+bool docopt__ends_options(const Docopt__Pattern *p, const char *arg, bool *value) {
+    if (!(p->flags & DOCOPT_OPTIONS_FIRST)) return strcmp(arg, "--") == 0;
+    if (*value) {
+        *value = false;
+        return false;
+    }
+    if (!docopt__is_option(arg)) return true;
+    *value = docopt__option_takes_next(p, arg);
+    return false;
+}
+
+void docopt__match_alloc(Docopt_Match *m, size_t count) {
+    m->kind   = docopt__arena_alloc(&m->arena, count * sizeof(m->kind[0]));
+    m->key    = docopt__arena_alloc(&m->arena, count * sizeof(m->key[0]));
+    m->value  = docopt__arena_alloc(&m->arena, count * sizeof(m->value[0]));
+    m->values = docopt__arena_alloc(&m->arena, count * sizeof(m->values[0]));
+    m->length = docopt__arena_alloc(&m->arena, count * sizeof(m->length[0]));
+}
+
+size_t docopt__option_words(const Docopt__Pattern *p) {
+    return (p->opattern_count + 63) / 64;
+}
+
+void docopt__match_options(Docopt_Match *m, const Docopt__Pattern *p) {
+    m->option_count = p->opattern_count;
+    m->option_key = p->option_key;
+    if (p->opattern_count == 0) return;
+    m->options = docopt__arena_alloc(&m->arena, docopt__option_words(p) * sizeof(uint64_t));
+    m->occurrences = docopt__arena_alloc(&m->arena, p->opattern_count * sizeof(int));
+    m->option_value = docopt__arena_alloc(&m->arena, p->opattern_count * sizeof(Docopt_Value));
+    if (p->option_default != NULL) memcpy(m->option_value, p->option_default, p->opattern_count * sizeof(Docopt_Value));
+    if (p->environment) return;
+    // patterns that did not come from docopt_compile, like the ones of docopt_util c
+    for (size_t i=0; i<p->opattern_count; i++) {
+        if (p->opattern[i].env.it[0] == '\0') continue;
+        const char *value = getenv(p->opattern[i].env.it);
+        if (value == NULL) continue;
+        memset(&m->option_value[i], 0, sizeof(Docopt_Value));
+        m->option_value[i].kind = DOCOPT_VALUE_STRING;
+        m->option_value[i].source = DOCOPT_SOURCE_ENVIRONMENT;
+        m->option_value[i].string = value;
+    }
+}
+
+void docopt__set_option_value(Docopt_Match *m, const Docopt__Leaf *leaf, const char *value) {
+    if (leaf->bit == 0 || value == NULL) return;
+    Docopt_Value *v = &m->option_value[leaf->bit - 1];
+    memset(v, 0, sizeof(*v));
+    v->kind = DOCOPT_VALUE_STRING;
+    v->source = DOCOPT_SOURCE_ARGV;
+    v->string = value;
+}
+
+// Whether the leaf is an occurrence of an option of the Options section, not its value.
+bool docopt__leaf_is_occurrence(const Docopt__Leaf *leaf) {
+    return leaf->bit != 0 && (leaf->kind == DOCOPT__LEAF_OPTION || leaf->kind == DOCOPT__LEAF_OPTION_KEY);
+}
+
+// Whether the leaf is a flag of the Options section, which only sets its bit.
+bool docopt__leaf_is_flag(const Docopt__Leaf *leaf) {
+    return leaf->kind == DOCOPT__LEAF_OPTION && leaf->bit != 0 && !leaf->takes_value;
+}
+
+void docopt__append_match(Docopt_Match *m, Docopt_Element_Kind kind, const char *key, const char *val) {
+    size_t n = m->count;
+    m->kind[n] = kind;
+    m->key[n] = key;
+    m->value[n] = val;
+    m->values[n] = &m->value[n];
+    m->length[n] = val != NULL;
+    m->count++;
+}
+
+// Whether the i-th element of argv continues the repeated argument of the element before.
+bool docopt__path_continues(const Docopt__Automaton *a, const int *path, int i) {
+    return i > 0 && path[i] == path[i-1] && a->leaf[path[i]].kind == DOCOPT__LEAF_ARGUMENT;
+}
+
+// Builds the match of argv that ends in leaf, where pred[i * stride + l] is the
+// leaf leaf l followed at the i-th element. path needs room for argc entries.
+// argc counts the elements expanded by token, see docopt__element.
+// If tail is not NULL, the tail_count elements at tail are a passthrough
+// bound to the argument leaf tail_leaf as a single entry.
+void docopt__automaton_build(const Docopt__Automaton *a, int argc, const char **argv, const Docopt__Token *token, const int *pred, size_t stride, int *path, size_t leaf, const char **tail, int tail_count, size_t tail_leaf, Docopt_Match *m) {
+    // without pred the path is already known
+    path[argc-1] = leaf;
+    for (int i=argc-1; i>0 && pred != NULL; i--) {
+        path[i-1] = pred[i * stride + path[i]];
+    }
+
+    size_t count = 0;
+    for (int i=0; i<argc; i++) {
+        const Docopt__Leaf *l = &a->leaf[path[i]];
+        if (docopt__leaf_is_occurrence(l) && m->occurrences[l->bit - 1]++ > 0) continue;
+        if (l->kind == DOCOPT__LEAF_OPTION_VALUE) continue;
+        if (docopt__leaf_is_flag(l)) continue;
+        if (docopt__path_continues(a, path, i)) continue;
+        count++;
+    }
+    if (tail != NULL) count++;
+    docopt__match_alloc(m, count);
+
+    // 1 + the entry of the i-th option once it has one, the entry the next value belongs to
+    int *entry = m->option_count > 0 ? docopt__arena_alloc(&m->arena, m->option_count * sizeof(int)) : NULL;
+    int current = -1;
+    m->count = 0;
+    for (int i=0; i<argc; i++) {
+        const Docopt__Leaf *l = &a->leaf[path[i]];
+        if (docopt__path_continues(a, path, i)) {
+            m->length[m->count-1]++;
+            continue;
+        }
+        if (l->bit != 0) docopt__set_add(m->options, l->bit - 1);
+        if (docopt__leaf_is_flag(l)) continue;
+        if (docopt__leaf_is_occurrence(l) && entry[l->bit - 1] != 0) {
+            // the values of a repeated option go to its first entry
+            current = entry[l->bit - 1] - 1;
+            if (l->kind == DOCOPT__LEAF_OPTION) {
+                const char *value = docopt__leaf_attached_value(l, docopt__element(argv, token, i));
+                m->values[current][m->length[current]++] = value;
+                docopt__set_option_value(m, l, value);
+            }
+            continue;
+        }
+        const char *arg = docopt__element(argv, token, i);
+        switch (l->kind) {
+            case DOCOPT__LEAF_PROGRAM:
+                docopt__append_match(m, DOCOPT_PROGRAM_NAME, l->key.it, arg);
+                break;
+            case DOCOPT__LEAF_COMMAND:
+                docopt__append_match(m, DOCOPT_SUBCOMMAND, NULL, arg);
+                break;
+            case DOCOPT__LEAF_ARGUMENT:
+                docopt__append_match(m, DOCOPT_ARGUMENT, l->key.it, arg);
+                m->values[m->count-1] = docopt__element_values(argv, token, i);
+                break;
+            case DOCOPT__LEAF_OPTION:
+                docopt__append_match(m, DOCOPT_OPTION, l->key.it, l->takes_value ? docopt__leaf_attached_value(l, arg) : NULL);
+                current = m->count-1;
+                docopt__set_option_value(m, l, m->value[current]);
+                break;
+            case DOCOPT__LEAF_OPTION_KEY:
+                docopt__append_match(m, DOCOPT_OPTION, l->key.it, NULL);
+                current = m->count-1;
+                break;
+            case DOCOPT__LEAF_OPTION_VALUE:
+                assert(current >= 0);
+                m->values[current][m->length[current]++] = arg;
+                m->value[current] = m->values[current][0];
+                docopt__set_option_value(m, l, arg);
+                break;
+            case DOCOPT__LEAF_KIND_COUNT:
+                assert(0);
+        }
+        if (docopt__leaf_is_occurrence(l)) {
+            int n = m->occurrences[l->bit - 1];
+            entry[l->bit - 1] = current + 1;
+            if (n > 1) {
+                const char **values = docopt__arena_alloc(&m->arena, n * sizeof(const char *));
+                if (m->length[current] > 0) values[0] = m->value[current];
+                m->values[current] = values;
+            }
+        }
+    }
+    if (tail != NULL) {
+        docopt__append_match(m, DOCOPT_ARGUMENT, a->leaf[tail_leaf].key.it, tail[0]);
+        m->values[m->count-1] = tail;
+        m->length[m->count-1] = tail_count;
+    }
+}
+
+// Builds the match of argv from the frontier after its last element.
+bool docopt__automaton_result(const Docopt__Automaton *a, int argc, const char **argv, const Docopt__Token *token, const int *pred, size_t stride, int *path, const uint64_t *frontier, Docopt_Match *m) {
+    size_t n = a->leaf_count;
+    for (size_t l = docopt__set_next(frontier, 0, n); l < n; l = docopt__set_next(frontier, l+1, n)) {
+        if (docopt__set_has(a->last, l)) {
+            docopt__automaton_build(a, argc, argv, token, pred, stride, path, l, NULL, 0, 0, m);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool docopt__leaf_is_passthrough(const Docopt__Leaf *leaf) {
+    return leaf->kind == DOCOPT__LEAF_COMMAND && strcmp(leaf->node->name.it, "--") == 0;
+}
+
+// The repeated argument that may take the rest of the usage line after the
+// passthrough leaf q, like <cmd> in -- <cmd>..., or a->leaf_count if there is none.
+size_t docopt__passthrough_leaf(const Docopt__Automaton *a, size_t q) {
+    size_t n = a->leaf_count;
+    const uint64_t *follow = docopt__automaton_follow(a, q);
+    for (size_t l = docopt__set_next(follow, 0, n); l < n; l = docopt__set_next(follow, l+1, n)) {
+        if (a->leaf[l].kind != DOCOPT__LEAF_ARGUMENT) continue;
+        if (!docopt__set_has(a->last, l) || !docopt__set_has(docopt__automaton_follow(a, l), l)) continue;
+        return l;
+    }
+    return n;
+}
+
+// Options first: once a positional element is consumed by a leaf that a repeated
+// argument may follow to the end of the usage line, like <command> in
+// prog [options] <command> [<args>...], the elements after it are bound to that
+// argument without matching them, nor classifying them. Otherwise matches like
+// docopt__automaton_match.
+bool docopt__automaton_options_first(const Docopt__Automaton *a, int argc, const char **argv, Docopt__Tokens *token, int *pred, int *path, uint64_t *frontier, Docopt_Match *m) {
+    uint64_t *from = frontier;
+    uint64_t *to = frontier + a->words;
+    memset(from, 0, a->words * sizeof(uint64_t));
+    docopt__set_add(from, 0);
+
+    size_t n = a->leaf_count;
+    bool positional = false;
+    for (int i=1; i<argc; i++) {
+        const Docopt__Token *t = docopt__token(token, i);
+        if (!docopt__automaton_step(a, from, t, to, pred + i * a->leaf_count)) return false;
+        uint64_t *tmp = from;
+        from = to;
+        to = tmp;
+
+        if (positional || i == argc-1 || docopt__token_is_option(t)) continue;
+        for (size_t q = docopt__set_next(from, 0, n); q < n; q = docopt__set_next(from, q+1, n)) {
+            Docopt__Leaf_Kind kind = a->leaf[q].kind;
+            if (kind != DOCOPT__LEAF_COMMAND && kind != DOCOPT__LEAF_ARGUMENT) continue;
+            positional = true;
+            size_t l = docopt__passthrough_leaf(a, q);
+            if (l == n) continue;
+            docopt__automaton_build(a, i+1, argv, token->token, pred, a->leaf_count, path, q, docopt__element_values(argv, token->token, i) + 1, argc - i-1, l, m);
+            return true;
+        }
+    }
+    return docopt__automaton_result(a, argc, argv, token->token, pred, a->leaf_count, path, from, m);
+}
+
+// Matches argv up to the element --, argv[dash], and binds all elements after it
+// to the repeated argument after -- in the usage line, without looking at them.
+// pred needs room for (dash+1) * a->leaf_count entries.
+bool docopt__automaton_passthrough(const Docopt__Automaton *a, int argc, const char **argv, const Docopt__Token *token, int dash, int *pred, int *path, uint64_t *frontier, Docopt_Match *m) {
+    uint64_t *from = frontier;
+    uint64_t *to = frontier + a->words;
+    memset(from, 0, a->words * sizeof(uint64_t));
+    docopt__set_add(from, 0);
+
+    for (int i=1; i<=dash; i++) {
+        if (!docopt__automaton_step(a, from, &token[i], to, pred + i * a->leaf_count)) return false;
+        uint64_t *tmp = from;
+        from = to;
+        to = tmp;
+    }
+
+    size_t n = a->leaf_count;
+    for (size_t q = docopt__set_next(from, 0, n); q < n; q = docopt__set_next(from, q+1, n)) {
+        if (!docopt__leaf_is_passthrough(&a->leaf[q])) continue;
+        if (dash == argc-1) {
+            if (!docopt__set_has(a->last, q)) continue;
+            docopt__automaton_build(a, dash+1, argv, token, pred, a->leaf_count, path, q, NULL, 0, 0, m);
+            return true;
+        }
+        size_t l = docopt__passthrough_leaf(a, q);
+        if (l == n) continue;
+        docopt__automaton_build(a, dash+1, argv, token, pred, a->leaf_count, path, q, docopt__element_values(argv, token, dash) + 1, argc - dash-1, l, m);
+        return true;
+    }
+    return false;
+}
+
+// Matches argv against an LL(1) usage line by following the only leaf that
+// may consume each element, without keeping a frontier or pred table.
+bool docopt__automaton_predict(const Docopt__Automaton *a, int argc, const char **argv, const Docopt__Token *token, int start, int *path, Docopt_Match *m) {
+    assert(a->ll1);
+    size_t n = a->leaf_count;
+    size_t q = start;
+    for (int i=0; i<=start; i++) path[i] = i;
+    for (int i=start+1; i<argc; i++) {
+        const uint64_t *follow = docopt__automaton_follow(a, q);
+        size_t l = docopt__set_next(follow, 0, n);
+        while (l < n && !docopt__leaf_matches(&a->leaf[l], &token[i])) l = docopt__set_next(follow, l+1, n);
+        if (l == n) return false;
+        path[i] = q = l;
+    }
+    if (!docopt__set_has(a->last, q)) return false;
+    docopt__automaton_build(a, argc, argv, token, NULL, 0, path, q, NULL, 0, 0, m);
+    return true;
+}
+
+// Matches argv against a single usage line. pred needs room for argc * a->leaf_count
+// entries, path for argc entries and frontier for 2 * a->words words.
+// The start elements after the program name are known to be the leading
+// commands of the line, which are its leaves 1 to start.
+bool docopt__automaton_match(const Docopt__Automaton *a, int argc, const char **argv, const Docopt__Token *token, int start, int *pred, int *path, uint64_t *frontier, Docopt_Match *m) {
+    assert(start < argc && (size_t) start < a->leaf_count);
+    assert(start == 0 || a->leaf[start].kind == DOCOPT__LEAF_COMMAND);
+    if (a->ll1) return docopt__automaton_predict(a, argc, argv, token, start, path, m);
+    uint64_t *from = frontier;
+    uint64_t *to = frontier + a->words;
+    memset(from, 0, a->words * sizeof(uint64_t));
+    docopt__set_add(from, start);
+    for (int i=1; i<=start; i++) pred[i * a->leaf_count + i] = i-1;
+
+    for (int i=start+1; i<argc; i++) {
+        if (!docopt__automaton_step(a, from, &token[i], to, pred + i * a->leaf_count)) return false;
+        uint64_t *tmp = from;
+        from = to;
+        to = tmp;
+    }
+    return docopt__automaton_result(a, argc, argv, token, pred, a->leaf_count, path, from, m);
+}
+
+// Every entry of a match consumes at least one element of argv.
+// Only the fixed buffers need this bound, otherwise the entries are counted first.
+size_t docopt__match_capacity(const Docopt__Pattern *p, int argc) {
+    (void) p;
+    return argc;
+}
+
+// Compiles all usage lines of p, such that matching afterwards does not allocate
+// anything but the match itself.
+// argc counts the elements of argv, count the ones they expand to.
+size_t docopt__match_size(const Docopt__Pattern *p, int argc, int count) {
+    size_t leaf_max = 0;
+    size_t words_max = 0;
+    for (size_t i=0; i<p->upattern_count; i++) {
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, i);
+        if (a->leaf_count > leaf_max) leaf_max = a->leaf_count;
+        if (a->words > words_max) words_max = a->words;
+    }
+    Docopt_Match m;
+    // the tokens, which double from argc until the stacks fit
+    size_t tokens = 0;
+    for (int capacity = argc; ; capacity *= 2) {
+        tokens += DOCOPT__ARENA_ALIGN(capacity * sizeof(Docopt__Token));
+        if (capacity >= count) break;
+    }
+    argc = count;
+    size_t cap = docopt__match_capacity(p, argc);
+    size_t sizes[] = {
+        cap * sizeof(m.kind[0]),
+        cap * sizeof(m.key[0]),
+        cap * sizeof(m.value[0]),
+        cap * sizeof(m.values[0]),
+        cap * sizeof(m.length[0]),
+        // the walk of the leading commands
+        argc * sizeof(int),
+        docopt__option_words(p) * sizeof(uint64_t),
+        // the occurrences and entries of the options and the values of repeated ones
+        p->opattern_count * sizeof(int),
+        p->opattern_count * sizeof(int),
+        p->opattern_count * sizeof(Docopt_Value),
+        argc * sizeof(const char *),
+        argc * leaf_max * sizeof(int),
+        argc * sizeof(int),
+        2 * words_max * sizeof(uint64_t),
+        // a failed attempt to pass the elements after -- through
+        argc * leaf_max * sizeof(int),
+        argc * sizeof(int),
+    };
+    return tokens + docopt__arena_fixed_size(sizes, sizeof(sizes)/sizeof(sizes[0]));
+}
+
+// Matches argv against the usage lines of p and builds the match in m. The
+// tokens and tables of the matching live in scratch, nothing in m points into it.
+bool docopt__match_argv(const Docopt__Pattern *p, int argc, const char **argv, Docopt__Arena *scratch, Docopt_Match *m) {
+    // every element is classified at most once, the leaves only compare against
+    // the token; the elements after the end of the options only if a usage line
+    // steps into them. From here on argc counts the elements with their stacks
+    // expanded, the tokens map them back to argv such that the match points into argv.
+    Docopt__Tokens tokens = docopt__tokens(p, argc, argv, scratch);
+    argc = docopt__tokens_count(&tokens);
+    int end = tokens.positional < argc ? tokens.positional : argc;
+    const Docopt__Token *token = tokens.token;
+
+    // the leading commands are compared once for all usage lines
+    int *walk = docopt__arena_alloc(scratch, argc * sizeof(int));
+    int depth = docopt__pattern_walk(p, argc, &tokens, walk);
+
+    size_t leaf_max = 0;
+    size_t words_max = 0;
+    for (size_t i=0; i<p->upattern_count; i++) {
+        if (!docopt__pattern_is_candidate(p, i, walk, depth, false)) continue;
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, i);
+        if (a->leaf_count > leaf_max) leaf_max = a->leaf_count;
+        if (a->words > words_max) words_max = a->words;
+    }
+    uint64_t *frontier = docopt__arena_alloc(scratch, 2 * words_max * sizeof(uint64_t));
+
+    // the elements after -- are not matched if a usage line passes them through,
+    // with options first -- is the first positional element anyway
+    int dash = p->flags & DOCOPT_OPTIONS_FIRST ? argc : end;
+    if (dash < argc) {
+        int *pred = docopt__arena_alloc(scratch, (dash+1) * leaf_max * sizeof(int));
+        int *path = docopt__arena_alloc(scratch, (dash+1) * sizeof(int));
+        for (size_t i=0; i<p->upattern_count; i++) {
+            if (!docopt__pattern_is_candidate(p, i, walk, depth, false)) continue;
+            if (docopt__automaton_passthrough(docopt__pattern_automaton(p, i), argc, argv, token, dash, pred, path, frontier, m)) return true;
+        }
+    }
+
+    // only lines that are not LL(1) record predecessors, pred is allocated for the first of them
+    int *pred = NULL;
+    int *path = docopt__arena_alloc(scratch, argc * sizeof(int));
+    for (size_t i=0; i<p->upattern_count; i++) {
+        if (!docopt__pattern_is_candidate(p, i, walk, depth, false)) continue;
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, i);
+        if (pred == NULL && (!a->ll1 || p->flags & DOCOPT_OPTIONS_FIRST)) {
+            pred = docopt__arena_alloc(scratch, argc * leaf_max * sizeof(int));
+        }
+        if (p->flags & DOCOPT_OPTIONS_FIRST) {
+            if (docopt__automaton_options_first(a, argc, argv, &tokens, pred, path, frontier, m)) return true;
+        } else {
+            // a usage line that does not pass the tail through matches it
+            docopt__token(&tokens, argc-1);
+            int start = docopt__pattern_prefix_length(p, i);
+            if (docopt__automaton_match(a, argc, argv, token, start, pred, path, frontier, m)) return true;
+        }
+    }
+    return false;
+}
+
+Docopt_Match docopt__match(const Docopt__Pattern *p, int argc, const char **argv, Docopt__Arena arena) {
+    Docopt_Match m = {0};
+    assert(argc > 0);
+    m.arena = arena;
+    docopt__match_options(&m, p);
+    // a fixed arena is sized for the scratch as well
+    Docopt__Arena scratch = {0};
+    if (!docopt__match_argv(p, argc, argv, m.arena.fixed ? &m.arena : &scratch, &m)) {
+        m.count = 0;
+        m.error = "no usage pattern matches the command line";
+    }
+    docopt__arena_free(&scratch);
+    return m;
+}
+
+// The usage lines are only set up once the second element of argv tells which
+// of them are candidates. From then on every element steps the frontiers of the
+// lines that still may match and records the predecessors of the step in pred.
+struct Docopt__Matcher {
+    const Docopt__Pattern *pattern;
+    // copies of the elements of argv fed so far
+    const char **arg;
+    int argc;
+    int arg_cap;
+    // set if a response file can not be read or once no usage line can match,
+    // after which nothing is stepped anymore
+    const char *error;
+    // the index of the element that ended the options, -- or with options first
+    // the first positional one, 0 if none was fed yet; the elements after it are
+    // positional. value is set while the next element is the value of an option.
+    int end;
+    bool value;
+    bool started;
+    bool *alive;
+    // the frontier of the i-th usage line is at offset[i], its predecessors at pred_offset[i]
+    size_t *offset;
+    size_t words;
+    uint64_t *frontier;
+    uint64_t *next;
+    size_t *pred_offset;
+    size_t pred_width;
+    int *pred;
+    Docopt__Arena arena;
+};
+
+Docopt_Matcher *docopt_matcher_new(const Docopt_Pattern *pattern) {
+    Docopt__Arena arena = {0};
+    Docopt_Matcher *m = docopt__arena_alloc(&arena, sizeof(Docopt_Matcher));
+    m->pattern = pattern;
+    m->alive = docopt__arena_alloc(&arena, pattern->upattern_count * sizeof(bool));
+    m->offset = docopt__arena_alloc(&arena, pattern->upattern_count * sizeof(size_t));
+    m->pred_offset = docopt__arena_alloc(&arena, pattern->upattern_count * sizeof(size_t));
+    m->arena = arena;
+    return m;
+}
+
+void docopt__matcher_step(Docopt_Matcher *m) {
+    const Docopt__Pattern *p = m->pattern;
+    int i = m->argc - 1;
+    int *pred = m->pred + i * m->pred_width;
+    Docopt__Token token = docopt__classify(m->arg[i]);
+    if (m->end > 0 && i > m->end) token.kind = DOCOPT__TOKEN_POSITIONAL;
+    for (size_t j=0; j<p->upattern_count; j++) {
+        if (!m->alive[j]) continue;
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, j);
+        uint64_t *to = m->next + m->offset[j];
+        m->alive[j] = docopt__automaton_step(a, m->frontier + m->offset[j], &token, to, pred + m->pred_offset[j]);
+        memcpy(m->frontier + m->offset[j], to, a->words * sizeof(uint64_t));
+    }
+}
+
+void docopt__matcher_start(Docopt_Matcher *m) {
+    const Docopt__Pattern *p = m->pattern;
+    m->started = true;
+    Docopt__Token token[2];
+    Docopt__Tokens tokens = {.argv = m->arg, .token = token, .positional = m->end > 0 ? m->end : m->argc};
+    int walk[2];
+    int depth = docopt__pattern_walk(p, 2, &tokens, walk);
+    for (size_t j=0; j<p->upattern_count; j++) {
+        m->alive[j] = docopt__pattern_is_candidate(p, j, walk, depth, depth == 1);
+        if (!m->alive[j]) continue;
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, j);
+        m->offset[j] = m->words;
+        m->words += a->words;
+        m->pred_offset[j] = m->pred_width;
+        m->pred_width += a->leaf_count;
+    }
+    m->frontier = docopt__arena_alloc(&m->arena, m->words * sizeof(uint64_t));
+    m->next = docopt__arena_alloc(&m->arena, m->words * sizeof(uint64_t));
+    if (m->pred_width > 0) {
+        m->pred = calloc(m->arg_cap * m->pred_width, sizeof(int));
+        assert(m->pred != NULL);
+    }
+    for (size_t j=0; j<p->upattern_count; j++) {
+        if (m->alive[j]) docopt__set_add(m->frontier + m->offset[j], 0);
+    }
+
+    int argc = m->argc;
+    for (m->argc = 2; m->argc <= argc; m->argc++) docopt__matcher_step(m);
+    m->argc = argc;
+}
+
+// Feeds arg without copying it.
+bool docopt__feed(Docopt_Matcher *m, const char *arg) {
+    if (m->error != NULL) return false;
+    if (m->argc == m->arg_cap) {
+        m->arg_cap = m->arg_cap == 0 ? 16 : 2 * m->arg_cap;
+        m->arg = realloc(m->arg, m->arg_cap * sizeof(const char *));
+        assert(m->arg != NULL);
+        if (m->started) {
+            m->pred = realloc(m->pred, m->arg_cap * m->pred_width * sizeof(int));
+            assert(m->pred != NULL);
+        }
+    }
+    m->arg[m->argc] = arg;
+    m->argc++;
+
+    if (m->argc < 2) return true;
+    if (!m->started) {
+        docopt__matcher_start(m);
+    } else {
+        docopt__matcher_step(m);
+    }
+    for (size_t j=0; j<m->pattern->upattern_count; j++) {
+        if (m->alive[j]) return true;
+    }
+    m->error = "no usage pattern matches the command line";
+    return false;
+}
+
+// Feeds arg, or the short options it stacks, without copying it.
+// After the end of the options nothing is split.
+bool docopt__feed_arg(Docopt_Matcher *m, const char *arg) {
+    if (m->end > 0 || m->argc == 0) return docopt__feed(m, arg);
+    if (docopt__ends_options(m->pattern, arg, &m->value)) {
+        m->end = m->argc;
+        return docopt__feed(m, arg);
+    }
+    const char *pieces[DOCOPT_SHORT_STRLEN];
+    int n = docopt__expand_short(m->pattern, arg, pieces);
+    if (n == 1) return docopt__feed(m, arg);
+    bool result = true;
+    for (int i=0; i<n && result; i++) result = docopt__feed(m, pieces[i]);
+    return result;
+}
+
+bool docopt_feed(Docopt_Matcher *m, const char *arg) {
+    return docopt__feed_arg(m, docopt__arena_strdup(&m->arena, arg));
+}
+
+// Reads the response file at path into the arena of the matcher and feeds its
+// lines, terminated in place. Files without a size, like pipes, are read into
+// a growing buffer first.
+bool docopt__feed_file(Docopt_Matcher *m, const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        m->error = "can not read response file";
+        return false;
+    }
+    bool sized = S_ISREG(st.st_mode);
+    size_t capacity = sized ? (size_t) st.st_size : DOCOPT__ARENA_BLOCK_SIZE;
+    char *data = sized ? docopt__arena_alloc(&m->arena, capacity + 1) : malloc(capacity + 1);
+    assert(data != NULL);
+    size_t size = 0;
+    ssize_t n = 0;
+    while (size < capacity || !sized) {
+        if (size == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity + 1);
+            assert(data != NULL);
+        }
+        n = read(fd, data + size, capacity - size);
+        if (n <= 0) break;
+        size += n;
+    }
+    close(fd);
+    if (!sized) {
+        char *copy = n < 0 ? NULL : docopt__arena_alloc(&m->arena, size + 1);
+        if (copy != NULL) memcpy(copy, data, size);
+        free(data);
+        data = copy;
+    }
+    if (n < 0) {
+        m->error = "can not read response file";
+        return false;
+    }
+    data[size] = '\0';
+
+    bool result = true;
+    for (size_t start = 0; start < size && result; ) {
+        char *nl = memchr(data + start, '\n', size - start);
+        size_t end = nl == NULL ? size : (size_t) (nl - data);
+        size_t next = end + 1;
+        if (end > start && data[end-1] == '\r') end--;
+        if (end > start) {
+            data[end] = '\0';
+            result = docopt__feed_arg(m, data + start);
+        }
+        start = next;
+    }
+    return result;
+}
+
+bool docopt_feed_expand(Docopt_Matcher *m, const char *arg) {
+    if (m->argc == 0 || arg[0] != '@') return docopt_feed(m, arg);
+    return docopt__feed_file(m, arg + 1);
+}
+
+Docopt_Match docopt_matcher_match(Docopt_Matcher *m) {
+    assert(m->argc > 0 || m->error != NULL);
+    const Docopt__Pattern *p = m->pattern;
+    int argc = m->argc;
+    const char **argv = m->arg;
+    if (m->error != NULL) {
+        Docopt_Match result = {0};
+        result.error = m->error;
+        return result;
+    }
+    // the usage lines are not set up until the second element
+    if (!m->started) return docopt__match(p, argc, argv, (Docopt__Arena) {0});
+    Docopt_Match result = {0};
+    docopt__match_options(&result, p);
+    Docopt__Arena scratch = {0};
+    int *path = docopt__arena_alloc(&scratch, argc * sizeof(int));
+
+    bool matched = false;
+    for (size_t j=0; j<p->upattern_count && !matched; j++) {
+        if (!m->alive[j]) continue;
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, j);
+        const int *pred = m->pred + m->pred_offset[j];
+        matched = docopt__automaton_result(a, argc, argv, NULL, pred, m->pred_width, path, m->frontier + m->offset[j], &result);
+    }
+    docopt__arena_free(&scratch);
+    if (!matched) {
+        result.count = 0;
+        result.error = "no usage pattern matches the command line";
+    }
+    return result;
+}
+
+void docopt_matcher_free(Docopt_Matcher *m) {
+    free(m->arg);
+    free(m->pred);
+    Docopt__Arena arena = m->arena;
+    docopt__arena_free(&arena);
+}
+
+// The frontier of every usage line after each element of argv that has been
+// completed, such that the next completion only advances by the new elements.
+struct Docopt__Completion {
+    const Docopt__Pattern *pattern;
+    // the frontier of the i-th usage line is at offset[i] within a frame
+    size_t *offset;
+    size_t frame_words;
+    uint64_t *frame;
+    size_t frame_count;
+    size_t frame_cap;
+    // arg[k] is the element of argv that lead to frame[k], value[k] is set if
+    // the element after it is the value of an option
+    char **arg;
+    bool *value;
+    // the frame of the element that ended the options, 0 if there is none
+    size_t end;
+    const char **word;
+    size_t word_count;
+    size_t word_cap;
+    Docopt__Arena arena;
+};
+
+Docopt_Completion *docopt_completion_new(const Docopt_Pattern *pattern) {
+    Docopt__Arena arena = {0};
+    Docopt_Completion *c = docopt__arena_alloc(&arena, sizeof(Docopt_Completion));
+    c->pattern = pattern;
+    c->offset = docopt__arena_alloc(&arena, pattern->upattern_count * sizeof(size_t));
+    for (size_t i=0; i<pattern->upattern_count; i++) {
+        c->offset[i] = c->frame_words;
+        c->frame_words += docopt__pattern_automaton(pattern, i)->words;
+    }
+
+    // the first frame is the program name
+    c->frame_cap = 16;
+    c->frame = calloc(c->frame_cap * c->frame_words, sizeof(uint64_t));
+    c->arg = calloc(c->frame_cap, sizeof(char *));
+    c->value = calloc(c->frame_cap, sizeof(bool));
+    assert(c->frame != NULL && c->arg != NULL && c->value != NULL);
+    for (size_t i=0; i<pattern->upattern_count; i++) {
+        docopt__set_add(c->frame + c->offset[i], 0);
+    }
+    c->frame_count = 1;
+    c->arena = arena;
+    return c;
+}
+
+void docopt__completion_add_word(Docopt_Completion *c, const char *word, const char *prefix) {
+    if (!docopt__str_isprefix(prefix, word)) return;
+    for (size_t i=0; i<c->word_count; i++) {
+        if (strcmp(c->word[i], word) == 0) return;
+    }
+    if (c->word_count == c->word_cap) {
+        c->word_cap = c->word_cap == 0 ? 16 : 2 * c->word_cap;
+        c->word = realloc(c->word, c->word_cap * sizeof(const char *));
+        assert(c->word != NULL);
+    }
+    c->word[c->word_count] = word;
+    c->word_count++;
+}
+
+void docopt__completion_add_leaf(Docopt_Completion *c, const Docopt__Leaf *leaf, const char *prefix) {
+    switch (leaf->kind) {
+        case DOCOPT__LEAF_PROGRAM:
+            break;
+        case DOCOPT__LEAF_COMMAND:
+        case DOCOPT__LEAF_ARGUMENT:
+            docopt__completion_add_word(c, leaf->node->name.it, prefix);
+            break;
+        case DOCOPT__LEAF_OPTION:
+        case DOCOPT__LEAF_OPTION_KEY:
+            if (leaf->option == NULL) {
+                docopt__completion_add_word(c, leaf->key.it, prefix);
+                break;
+            }
+            for (size_t k=0; k<DOCOPT__OPTION_KEY_CAPACITY && leaf->option->key[k].it[0] != '\0'; k++) {
+                docopt__completion_add_word(c, leaf->option->key[k].it, prefix);
+            }
+            break;
+        case DOCOPT__LEAF_OPTION_VALUE:
+            if (leaf->option != NULL) {
+                docopt__completion_add_word(c, leaf->option->value.it, prefix);
+            } else {
+                docopt__completion_add_word(c, strchr(leaf->node->name.it, '=') + 1, prefix);
+            }
+            break;
+        case DOCOPT__LEAF_KIND_COUNT:
+            assert(0);
+    }
+}
+
+int docopt_complete(Docopt_Completion *c, int argc, const char **argv, const char ***words) {
+    assert(argc > 0);
+    const Docopt__Pattern *p = c->pattern;
+
+    // keep the frames of the elements argv has in common with the previous call
+    size_t keep = 1;
+    while (keep < c->frame_count && (int) keep < argc-1 && strcmp(c->arg[keep], argv[keep]) == 0) keep++;
+    for (size_t k=keep; k<c->frame_count; k++) {
+        free(c->arg[k]);
+        c->arg[k] = NULL;
+    }
+    c->frame_count = keep;
+    if (c->end >= keep) c->end = 0;
+
+    for (int k=keep; k<argc-1; k++) {
+        if (c->frame_count == c->frame_cap) {
+            c->frame_cap *= 2;
+            c->frame = realloc(c->frame, c->frame_cap * c->frame_words * sizeof(uint64_t));
+            c->arg = realloc(c->arg, c->frame_cap * sizeof(char *));
+            c->value = realloc(c->value, c->frame_cap * sizeof(bool));
+            assert(c->frame != NULL && c->arg != NULL && c->value != NULL);
+        }
+        const uint64_t *from = c->frame + (k-1) * c->frame_words;
+        uint64_t *to = c->frame + k * c->frame_words;
+        Docopt__Token token = docopt__classify(argv[k]);
+        c->value[k] = c->value[k-1];
+        if (c->end > 0) {
+            token.kind = DOCOPT__TOKEN_POSITIONAL;
+        } else if (docopt__ends_options(p, argv[k], &c->value[k])) {
+            c->end = k;
+        }
+        for (size_t i=0; i<p->upattern_count; i++) {
+            docopt__automaton_step(docopt__pattern_automaton(p, i), from + c->offset[i], &token, to + c->offset[i], NULL);
+        }
+        c->arg[k] = strdup(argv[k]);
+        c->frame_count++;
+    }
+
+    c->word_count = 0;
+    const uint64_t *frame = c->frame + (c->frame_count-1) * c->frame_words;
+    for (size_t i=0; i<p->upattern_count; i++) {
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, i);
+        const uint64_t *from = frame + c->offset[i];
+        size_t n = a->leaf_count;
+        for (size_t q = docopt__set_next(from, 0, n); q < n; q = docopt__set_next(from, q+1, n)) {
+            const uint64_t *follow = docopt__automaton_follow(a, q);
+            for (size_t l = docopt__set_next(follow, 0, n); l < n; l = docopt__set_next(follow, l+1, n)) {
+                // after the end of the options the word is positional
+                const Docopt__Leaf *leaf = &a->leaf[l];
+                if (c->end > 0 && (leaf->kind == DOCOPT__LEAF_OPTION || leaf->kind == DOCOPT__LEAF_OPTION_KEY)) continue;
+                docopt__completion_add_leaf(c, leaf, argv[argc-1]);
+            }
+        }
+    }
+    *words = c->word;
+    return c->word_count;
+}
+
+void docopt_completion_free(Docopt_Completion *c) {
+    for (size_t k=0; k<c->frame_count; k++) {
+        free(c->arg[k]);
+    }
+    free(c->arg);
+    free(c->value);
+    free(c->frame);
+    free(c->word);
+    Docopt__Arena arena = c->arena;
+    docopt__arena_free(&arena);
+}
+
+extern char **environ;
+
+// Reads the environment variables of the options once into their defaults, such
+// that the matches do not call getenv. environ is scanned a single time against
+// a hash table of the names the options refer to, the values are copied.
+void docopt__pattern_environment(Docopt__Pattern *p) {
+    size_t count = 0;
+    for (size_t i=0; i<p->opattern_count; i++) count += p->opattern[i].env.it[0] != '\0';
+    p->environment = true;
+    if (count == 0) return;
+
+    // open addressing in a power of two of at least twice as many slots as
+    // variables, such that the probes of the environment stay short
+    size_t capacity = 1;
+    while (capacity < 2 * count) capacity *= 2;
+    // 1 + the option whose variable hashes to the slot, 0 if the slot is free
+    size_t *table = docopt__arena_alloc(&p->arena, capacity * sizeof(size_t));
+    uint64_t *hash = docopt__arena_alloc(&p->arena, p->opattern_count * sizeof(uint64_t));
+    for (size_t i=0; i<p->opattern_count; i++) {
+        const char *name = p->opattern[i].env.it;
+        if (name[0] == '\0') continue;
+        hash[i] = docopt__hash(name, strlen(name));
+        size_t slot = hash[i] & (capacity - 1);
+        while (table[slot] != 0) slot = (slot + 1) & (capacity - 1);
+        table[slot] = i + 1;
+    }
+
+    Docopt_Value *option_default = docopt__arena_alloc(&p->arena, p->opattern_count * sizeof(Docopt_Value));
+    if (p->option_default != NULL) memcpy(option_default, p->option_default, p->opattern_count * sizeof(Docopt_Value));
+    for (char **e = environ; *e != NULL; e++) {
+        const char *eq = strchr(*e, '=');
+        if (eq == NULL) continue;
+        size_t n = eq - *e;
+        uint64_t h = docopt__hash(*e, n);
+        for (size_t slot = h & (capacity - 1); table[slot] != 0; slot = (slot + 1) & (capacity - 1)) {
+            size_t i = table[slot] - 1;
+            const char *name = p->opattern[i].env.it;
+            if (hash[i] != h || strncmp(name, *e, n) != 0 || name[n] != '\0') continue;
+            // the variables of the options do not depend on the environment afterwards
+            Docopt_Value v = {0};
+            v.kind = DOCOPT_VALUE_STRING;
+            v.source = DOCOPT_SOURCE_ENVIRONMENT;
+            v.string = docopt__arena_strdup(&p->arena, eq + 1);
+            option_default[i] = v;
+        }
+    }
+    p->option_default = option_default;
+}
+
+Docopt_Pattern *docopt_compile(const char *help) {
+    return docopt_compile_ex(help, 0);
+}
+
+Docopt_Pattern *docopt_compile_ex(const char *help, int flags) {
+    Docopt__Pattern p = docopt__compile_pattern(help);
+    p.flags = flags;
+    docopt__pattern_environment(&p);
+    Docopt__Pattern *result = docopt__arena_alloc(&p.arena, sizeof(Docopt__Pattern));
+    *result = p;
+    return result;
+}
+
+Docopt_Match docopt_match(const Docopt_Pattern *pattern, int argc, const char **argv) {
+    Docopt__Arena arena = {0};
+    return docopt__match(pattern, argc, argv, arena);
+}
+
+Docopt_Match docopt_interpret(const char *help, int argc, const char **argv) {
+    Docopt__Pattern p = docopt__compile_pattern(help);
+    Docopt__Arena arena = {0};
+    Docopt_Match m = docopt__match(&p, argc, argv, arena);
+    // the keys of the match point into the pattern
+    for (size_t i=0; i<p.upattern_count; i++) {
+        docopt__arena_move(&m.arena, &p.usage[i].arena);
+    }
+    docopt__arena_move(&m.arena, &p.keys->arena);
+    docopt__arena_move(&m.arena, &p.arena);
+    return m;
+}
+
+int docopt_option_bit(const Docopt_Pattern *pattern, const char *key) {
+    const Docopt__OPattern *o = docopt__find_opattern(pattern->opattern, pattern->opattern_count, key);
+    return o == NULL ? -1 : (int) (o - pattern->opattern);
+}
+
+struct Docopt__Config {
+    const char *data;
+    size_t size;
+    // the values read so far
+    Docopt__Arena arena;
+};
+
+bool docopt_match_config(Docopt_Match *m, const char *key) {
+    if (m->error != NULL || m->config != NULL) return false;
+    const char *path = NULL;
+    for (int b=0; b<m->option_count && path == NULL; b++) {
+        if (strcmp(m->option_key[b], key) == 0) path = m->option_value[b].string;
+    }
+    if (path == NULL) return false;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void *data = NULL;
+    if (st.st_size > 0) data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    Docopt__Config *config = calloc(1, sizeof(Docopt__Config));
+    assert(config != NULL);
+    config->data = data;
+    config->size = st.st_size;
+    m->config = config;
+    return true;
+}
+
+bool docopt__is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// The value of the line name = value of the config file, NULL if there is none.
+// The file is only scanned now, the lines are not parsed up front.
+const char *docopt__config_get(Docopt__Config *c, const char *name) {
+    size_t n = strlen(name);
+    const char *result = NULL;
+    const char *value = NULL;
+    size_t length = 0;
+    for (size_t start = 0; start < c->size; ) {
+        const char *line = c->data + start;
+        const char *nl = memchr(line, '\n', c->size - start);
+        const char *end = nl == NULL ? c->data + c->size : nl;
+        start = end - c->data + 1;
+
+        while (line < end && docopt__is_blank(*line)) line++;
+        if ((size_t) (end - line) <= n || memcmp(line, name, n) != 0) continue;
+        const char *eq = line + n;
+        while (eq < end && docopt__is_blank(*eq)) eq++;
+        if (eq == end || *eq != '=') continue;
+        // the last line of a name wins
+        value = eq + 1;
+        while (value < end && docopt__is_blank(*value)) value++;
+        length = end - value;
+        while (length > 0 && docopt__is_blank(value[length-1])) length--;
+        result = value;
+    }
+    if (result == NULL) return NULL;
+    char *copy = docopt__arena_alloc(&c->arena, length + 1);
+    memcpy(copy, value, length);
+    return copy;
+}
+
+// The value of the option or argument reported as key, DOCOPT_VALUE_NONE if there is none.
+// A default is looked up in the config file and replaced by its value there.
+Docopt_Value docopt__match_get(Docopt_Match *m, const char *key) {
+    Docopt_Value result = {0};
+    if (m->error != NULL) return result;
+    for (int b=0; b<m->option_count; b++) {
+        if (strcmp(m->option_key[b], key) != 0) continue;
+        Docopt_Value *v = &m->option_value[b];
+        if (v->source == DOCOPT_SOURCE_DEFAULT && m->config != NULL) {
+            const char *value = docopt__config_get(m->config, key + strspn(key, "-"));
+            if (value != NULL) {
+                // later queries do not scan the file again
+                memset(v, 0, sizeof(*v));
+                v->kind = DOCOPT_VALUE_STRING;
+                v->source = DOCOPT_SOURCE_CONFIG;
+                v->string = value;
+            }
+        }
+        return *v;
+    }
+    for (int i=0; i<m->count; i++) {
+        if (m->kind[i] != DOCOPT_ARGUMENT && m->kind[i] != DOCOPT_OPTION) continue;
+        if (m->value[i] == NULL || strcmp(m->key[i], key) != 0) continue;
+        result.kind = DOCOPT_VALUE_STRING;
+        result.string = m->value[i];
+        break;
+    }
+    return result;
+}
+
+bool docopt_get_i64(Docopt_Match *match, const char *key, int64_t *value) {
+    Docopt_Value v = docopt__match_get(match, key);
+    if (v.kind == DOCOPT_VALUE_INT) {
+        *value = v.i64;
+        return true;
+    }
+    if (v.kind != DOCOPT_VALUE_STRING) return false;
+    const char *end = docopt__parse_i64(v.string, value);
+    return end != NULL && *end == '\0';
+}
+
+bool docopt_get_f64(Docopt_Match *match, const char *key, double *value) {
+    Docopt_Value v = docopt__match_get(match, key);
+    if (v.kind == DOCOPT_VALUE_DOUBLE || v.kind == DOCOPT_VALUE_INT) {
+        *value = v.kind == DOCOPT_VALUE_DOUBLE ? v.f64 : (double) v.i64;
+        return true;
+    }
+    if (v.kind != DOCOPT_VALUE_STRING) return false;
+    const char *end = docopt__parse_f64(v.string, value);
+    return end != NULL && *end == '\0';
+}
+
+bool docopt_get_duration(Docopt_Match *match, const char *key, int64_t *milliseconds) {
+    Docopt_Value v = docopt__match_get(match, key);
+    if (v.kind == DOCOPT_VALUE_NONE || v.kind == DOCOPT_VALUE_BOOL) return false;
+    const char *end = docopt__parse_duration(v.string, milliseconds);
+    return end != NULL && *end == '\0';
+}
+
+bool docopt_get_size(Docopt_Match *match, const char *key, uint64_t *bytes) {
+    Docopt_Value v = docopt__match_get(match, key);
+    if (v.kind == DOCOPT_VALUE_NONE || v.kind == DOCOPT_VALUE_BOOL) return false;
+    const char *end = docopt__parse_size(v.string, bytes);
+    return end != NULL && *end == '\0';
+}
+
+size_t docopt_match_size(const Docopt_Pattern *pattern, int argc, const char **argv) {
+    if (argc <= 0) return 0;
+    Docopt__Tokens tokens = docopt__tokens(pattern, argc, argv, NULL);
+    return docopt__match_size(pattern, argc, docopt__tokens_count(&tokens));
+}
+
+bool docopt_match_buffer(const Docopt_Pattern *pattern, int argc, const char **argv, void *buffer, size_t size, Docopt_Match *match) {
+    if (argc <= 0) return false;
+    if (size < docopt_match_size(pattern, argc, argv)) return false;
+    Docopt__Arena arena = docopt__arena_fixed(buffer, size);
+    *match = docopt__match(pattern, argc, argv, arena);
+    return true;
+}
+
+void docopt_pattern_free(Docopt_Pattern *pattern) {
+    if (pattern->usage != NULL) {
+        for (size_t i=0; i<pattern->upattern_count; i++) {
+            docopt__arena_free(&pattern->usage[i].arena);
+        }
+    }
+    if (pattern->keys != NULL) docopt__arena_free(&pattern->keys->arena);
+    // the pattern might itself live in its arena
+    Docopt__Arena arena = pattern->arena;
+    docopt__arena_free(&arena);
+}
+
+void docopt_match_free(Docopt_Match *match) {
+    if (match->config != NULL) {
+        if (match->config->data != NULL) munmap((void *) match->config->data, match->config->size);
+        docopt__arena_free(&match->config->arena);
+        free(match->config);
+        match->config = NULL;
+    }
+    docopt__arena_free(&match->arena);
+    match->count = 0;
+    match->error = NULL;
+    match->kind  = NULL;
+    match->key   = NULL;
+    match->value = NULL;
+    match->values = NULL;
+    match->length = NULL;
+    match->options = NULL;
+    match->option_count = 0;
+    match->option_key = NULL;
+    match->occurrences = NULL;
+    match->option_value = NULL;
+}
+
+void docopt__emit_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const char *c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (isprint((unsigned char) *c)) {
+            fputc(*c, out);
+        } else {
+            fprintf(out, "\\%03o", (unsigned char) *c);
+        }
+    }
+    fputc('"', out);
+}
+
+size_t docopt__upattern_size(const Docopt__UPattern *p) {
+    if (p == NULL) return 0;
+    return 1 + docopt__upattern_size(p->head) + docopt__upattern_size(p->rest);
+}
+
+const char *docopt__upattern_kind_name(Docopt__UPattern_Kind kind) {
+    switch (kind) {
+        case DOCOPT__UPATTERN_ROOT:   return "DOCOPT__UPATTERN_ROOT";
+        case DOCOPT__UPATTERN_SIMPLE: return "DOCOPT__UPATTERN_SIMPLE";
+        case DOCOPT__UPATTERN_GROUP:  return "DOCOPT__UPATTERN_GROUP";
+        case DOCOPT__UPATTERN_KIND_COUNT: assert(0);
+    }
+    assert(0);
+}
+
+// Emits the fields of p, where the head is the node at index i in the node array
+// of the given name and the rest follows the descendants of the head.
+void docopt__emit_upattern_fields(FILE *out, const char *name, const Docopt__UPattern *p, size_t i) {
+    fprintf(out, "{.kind = %s", docopt__upattern_kind_name(p->kind));
+    if (p->kind == DOCOPT__UPATTERN_SIMPLE) {
+        fprintf(out, ", .name = {");
+        docopt__emit_string(out, p->name.it);
+        fprintf(out, "}");
+    }
+    if (p->optional)    fprintf(out, ", .optional = true");
+    if (p->alternative) fprintf(out, ", .alternative = true");
+    if (p->repeat)      fprintf(out, ", .repeat = true");
+    if (p->head != NULL) fprintf(out, ", .head = &%s__unode[%zu]", name, i);
+    if (p->rest != NULL) fprintf(out, ", .rest = &%s__unode[%zu]", name, i + docopt__upattern_size(p->head));
+    fprintf(out, "}");
+}
+
+// Finds target among p and its descendants in pre-order, counting the nodes before it in *i.
+bool docopt__upattern_find(const Docopt__UPattern *p, const Docopt__UPattern *target, size_t *i) {
+    if (p == NULL) return false;
+    if (p == target) return true;
+    (*i)++;
+    return docopt__upattern_find(p->head, target, i) || docopt__upattern_find(p->rest, target, i);
+}
+
+const char *docopt__leaf_kind_name(Docopt__Leaf_Kind kind) {
+    switch (kind) {
+        case DOCOPT__LEAF_PROGRAM:      return "DOCOPT__LEAF_PROGRAM";
+        case DOCOPT__LEAF_COMMAND:      return "DOCOPT__LEAF_COMMAND";
+        case DOCOPT__LEAF_ARGUMENT:     return "DOCOPT__LEAF_ARGUMENT";
+        case DOCOPT__LEAF_OPTION:       return "DOCOPT__LEAF_OPTION";
+        case DOCOPT__LEAF_OPTION_KEY:   return "DOCOPT__LEAF_OPTION_KEY";
+        case DOCOPT__LEAF_OPTION_VALUE: return "DOCOPT__LEAF_OPTION_VALUE";
+        case DOCOPT__LEAF_KIND_COUNT: assert(0);
+    }
+    assert(0);
+}
+
+void docopt__emit_set(FILE *out, const uint64_t *set, size_t words) {
+    for (size_t i=0; i<words; i++) {
+        fprintf(out, " 0x%016llxull,", (unsigned long long) set[i]);
+    }
+}
+
+const char *docopt__value_kind_name(Docopt_Value_Kind kind) {
+    switch (kind) {
+        case DOCOPT_VALUE_NONE:   return "DOCOPT_VALUE_NONE";
+        case DOCOPT_VALUE_STRING: return "DOCOPT_VALUE_STRING";
+        case DOCOPT_VALUE_BOOL:   return "DOCOPT_VALUE_BOOL";
+        case DOCOPT_VALUE_INT:    return "DOCOPT_VALUE_INT";
+        case DOCOPT_VALUE_DOUBLE: return "DOCOPT_VALUE_DOUBLE";
+    }
+    assert(0);
+}
+
+// Emits v with the C expression string as its string, if any.
+void docopt__emit_value(FILE *out, const Docopt_Value *v, const char *string) {
+    if (v->kind == DOCOPT_VALUE_NONE) {
+        fprintf(out, "{0}");
+        return;
+    }
+    fprintf(out, "{.kind = %s", docopt__value_kind_name(v->kind));
+    if (string != NULL) fprintf(out, ", .string = %s", string);
+    switch (v->kind) {
+        case DOCOPT_VALUE_BOOL:   fprintf(out, ", .b = %s", v->b ? "true" : "false"); break;
+        case DOCOPT_VALUE_INT:    fprintf(out, ", .i64 = %lld", (long long) v->i64); break;
+        case DOCOPT_VALUE_DOUBLE: fprintf(out, ", .f64 = %a", v->f64); break;
+        default: break;
+    }
+    fprintf(out, "}");
+}
+
+// Emits p and its descendants in pre-order with p at index i.
+void docopt__emit_unode(FILE *out, const char *name, const Docopt__UPattern *p, size_t i) {
+    if (p == NULL) return;
+    fprintf(out, "    /* %3zu */ ", i);
+    docopt__emit_upattern_fields(out, name, p, i+1);
+    fprintf(out, ",\n");
+    docopt__emit_unode(out, name, p->head, i+1);
+    docopt__emit_unode(out, name, p->rest, i+1 + docopt__upattern_size(p->head));
+}
+
+// Emits the compiled pattern as static const C initializers, such that a program
+// can match against it without compiling the help message at runtime.
+// The output has to be included after docopt.h with DOCOPT_IMPLEMENTATION defined.
+void docopt__emit_pattern(FILE *out, const Docopt__Pattern *p, const char *name) {
+    size_t unode_count = 0;
+    for (size_t i=0; i<p->upattern_count; i++) {
+        unode_count += docopt__upattern_size(docopt__pattern_upattern(p, i)) - 1;
+    }
+
+    if (unode_count > 0) {
+        fprintf(out, "static const Docopt__UPattern %s__unode[] = {\n", name);
+        size_t i = 0;
+        for (size_t j=0; j<p->upattern_count; j++) {
+            const Docopt__UPattern *root = docopt__pattern_upattern(p, j);
+            docopt__emit_unode(out, name, root->head, i);
+            i += docopt__upattern_size(root->head);
+            docopt__emit_unode(out, name, root->rest, i);
+            i += docopt__upattern_size(root->rest);
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    if (p->upattern_count > 0) {
+        fprintf(out, "static const Docopt__UPattern %s__upattern[] = {\n", name);
+        size_t i = 0;
+        for (size_t j=0; j<p->upattern_count; j++) {
+            fprintf(out, "    ");
+            const Docopt__UPattern *root = docopt__pattern_upattern(p, j);
+            docopt__emit_upattern_fields(out, name, root, i);
+            fprintf(out, ",\n");
+            i += docopt__upattern_size(root) - 1;
+        }
+        fprintf(out, "};\n\n");
+    }
+
+
+    if (p->opattern_count > 0) {
+        fprintf(out, "static const Docopt__OPattern %s__opattern[] = {\n", name);
+        for (size_t i=0; i<p->opattern_count; i++) {
+            const Docopt__OPattern *o = &p->opattern[i];
+            fprintf(out, "    {.key = {");
+            for (size_t k=0; k<DOCOPT__OPTION_KEY_CAPACITY && o->key[k].it[0] != '\0'; k++) {
+                if (k > 0) fprintf(out, ", ");
+                fprintf(out, "{");
+                docopt__emit_string(out, o->key[k].it);
+                fprintf(out, "}");
+            }
+            fprintf(out, "}, .value = {");
+            docopt__emit_string(out, o->value.it);
+            fprintf(out, "}");
+            if (o->def.it[0] != '\0') {
+                fprintf(out, ", .def = {");
+                docopt__emit_string(out, o->def.it);
+                fprintf(out, "}, .def_value = ");
+                docopt__emit_value(out, &o->def_value, NULL);
+            }
+            if (o->env.it[0] != '\0') {
+                fprintf(out, ", .env = {");
+                docopt__emit_string(out, o->env.it);
+                fprintf(out, "}");
+            }
+            fprintf(out, "},\n");
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    if (p->option_default != NULL) {
+        fprintf(out, "static const Docopt_Value %s__option_default[] = {\n", name);
+        for (size_t i=0; i<p->opattern_count; i++) {
+            char string[DOCOPT_SHORT_STRLEN + 32];
+            snprintf(string, sizeof(string), "%s__opattern[%zu].def.it", name, i);
+            fprintf(out, "    ");
+            docopt__emit_value(out, &p->option_default[i], string);
+            fprintf(out, ",\n");
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    if (p->short_option != NULL) {
+        fprintf(out, "static const unsigned char %s__short_option[256] = {\n", name);
+        for (size_t c=0; c<256; c++) {
+            if (p->short_option[c] != 0) fprintf(out, "    [%zu] = %d,\n", c, p->short_option[c]);
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    if (p->option_key != NULL) {
+        fprintf(out, "static const char *const %s__option_key[] = {\n", name);
+        for (size_t i=0; i<p->opattern_count; i++) {
+            fprintf(out, "    %s__opattern[%zu].key[%zu].it,\n", name, i, docopt__opattern_name_index(&p->opattern[i]));
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    size_t leaf_count = 0;
+    for (size_t i=0; i<p->upattern_count; i++) {
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, i);
+        leaf_count += a->leaf_count;
+    }
+
+    if (leaf_count > 0) {
+        fprintf(out, "static const Docopt__Leaf %s__leaf[] = {\n", name);
+        size_t base = 0;
+        for (size_t j=0; j<p->upattern_count; j++) {
+            const Docopt__UPattern *root = docopt__pattern_upattern(p, j);
+            const Docopt__Automaton *a = docopt__pattern_automaton(p, j);
+            for (size_t l=0; l<a->leaf_count; l++) {
+                const Docopt__Leaf *leaf = &a->leaf[l];
+                size_t i = base;
+                bool found = docopt__upattern_find(root->head, leaf->node, &i) || docopt__upattern_find(root->rest, leaf->node, &i);
+                assert(found);
+                fprintf(out, "    {.kind = %s, .node = &%s__unode[%zu]", docopt__leaf_kind_name(leaf->kind), name, i);
+                if (leaf->option != NULL) fprintf(out, ", .option = &%s__opattern[%zu]", name, (size_t) (leaf->option - p->opattern));
+                fprintf(out, ", .key = {");
+                docopt__emit_string(out, leaf->key.it);
+                fprintf(out, "}");
+                if (leaf->takes_value) fprintf(out, ", .takes_value = true");
+                if (leaf->repeats) fprintf(out, ", .repeats = true");
+                if (leaf->bit != 0) fprintf(out, ", .bit = %d", leaf->bit);
+                if (leaf->hash[0] != 0) {
+                    fprintf(out, ", .hash = {");
+                    for (size_t k=0; k<DOCOPT__OPTION_KEY_CAPACITY && leaf->hash[k] != 0; k++) {
+                        fprintf(out, "%s0x%016llxull", k == 0 ? "" : ", ", (unsigned long long) leaf->hash[k]);
+                    }
+                    fprintf(out, "}");
+                }
+                fprintf(out, "},\n");
+            }
+            base += docopt__upattern_size(root) - 1;
+        }
+        fprintf(out, "};\n\n");
+
+        fprintf(out, "static const uint64_t %s__set[] = {\n", name);
+        for (size_t j=0; j<p->upattern_count; j++) {
+            const Docopt__Automaton *a = docopt__pattern_automaton(p, j);
+            for (size_t l=0; l<a->leaf_count; l++) {
+                fprintf(out, "   ");
+                docopt__emit_set(out, docopt__automaton_follow(a, l), a->words);
+                fprintf(out, "\n");
+            }
+            fprintf(out, "   ");
+            docopt__emit_set(out, a->last, a->words);
+            fprintf(out, "\n");
+        }
+        fprintf(out, "};\n\n");
+
+        fprintf(out, "static const Docopt__Automaton %s__automaton[] = {\n", name);
+        size_t leaf = 0;
+        size_t set = 0;
+        for (size_t j=0; j<p->upattern_count; j++) {
+            const Docopt__Automaton *a = docopt__pattern_automaton(p, j);
+            fprintf(out, "    {.leaf_count = %zu, .leaf = &%s__leaf[%zu], .words = %zu, .follow = &%s__set[%zu], .last = &%s__set[%zu], .ll1 = %s},\n",
+                    a->leaf_count, name, leaf, a->words, name, set, name, set + a->leaf_count * a->words, a->ll1 ? "true" : "false");
+            leaf += a->leaf_count;
+            set += (a->leaf_count + 1) * a->words;
+        }
+        fprintf(out, "};\n\n");
+    }
+    const Docopt__Keys *keys = docopt__pattern_keys(p);
+    if (keys->count > 0) {
+        fprintf(out, "static const Docopt__Key %s__key[] = {\n", name);
+        for (size_t i=0; i<keys->count; i++) {
+            const Docopt__Key *k = &keys->key[i];
+            fprintf(out, "    {.key = ");
+            docopt__emit_string(out, k->key);
+            if (k->bit != 0) fprintf(out, ", .bit = %d", k->bit);
+            if (k->valued) fprintf(out, ", .valued = true");
+            if (k->repeats) fprintf(out, ", .repeats = true");
+            fprintf(out, "},\n");
+        }
+        fprintf(out, "};\n\n");
+    }
+    fprintf(out, "static Docopt__Keys %s__keys = {.state = DOCOPT__USAGE_COMPILED, .count = %zu", name, keys->count);
+    if (keys->count > 0) fprintf(out, ", .key = %s__key", name);
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const Docopt_Pattern %s = {\n", name);
+    fprintf(out, "    .upattern_count = %zu,\n", p->upattern_count);
+    if (p->upattern_count > 0) fprintf(out, "    .upattern = %s__upattern,\n", name);
+    if (leaf_count > 0) fprintf(out, "    .automaton = %s__automaton,\n", name);
+    fprintf(out, "    .opattern_count = %zu,\n", p->opattern_count);
+    if (p->opattern_count > 0) fprintf(out, "    .opattern = %s__opattern,\n", name);
+    if (p->short_option != NULL) fprintf(out, "    .short_option = %s__short_option,\n", name);
+    if (p->option_key != NULL) fprintf(out, "    .option_key = %s__option_key,\n", name);
+    if (p->option_default != NULL) fprintf(out, "    .option_default = %s__option_default,\n", name);
+    if (p->flags & DOCOPT_OPTIONS_FIRST) fprintf(out, "    .flags = DOCOPT_OPTIONS_FIRST,\n");
+    fprintf(out, "    .keys = &%s__keys,\n", name);
+    fprintf(out, "};\n");
+}
+
+// The elements of argv that every leaf consumes alike: a command or option
+// key, an option with its value attached, any other option, any other word.
+typedef enum {
+    DOCOPT__CLASS_WORD,
+    DOCOPT__CLASS_ATTACHED,
+    DOCOPT__CLASS_OPTION,
+    DOCOPT__CLASS_ARGUMENT,
+} Docopt__Class_Kind;
+
+typedef struct {
+    Docopt__Class_Kind kind;
+    Docopt__Short_String word;
+} Docopt__Class;
+
+// An element of argv in the class, to step the automata by.
+Docopt__Short_String docopt__class_sample(const Docopt__Class *c) {
+    Docopt__Short_String result = c->word;
+    size_t n = strlen(result.it);
+    switch (c->kind) {
+        case DOCOPT__CLASS_WORD:
+            break;
+        case DOCOPT__CLASS_ATTACHED:
+            assert(n+2 < DOCOPT_SHORT_STRLEN);
+            if (docopt__str_isprefix("--", result.it)) result.it[n++] = '=';
+            result.it[n++] = 'x';
+            result.it[n] = '\0';
+            break;
+        case DOCOPT__CLASS_OPTION:
+            strcpy(result.it, "-\001");
+            break;
+        case DOCOPT__CLASS_ARGUMENT:
+            strcpy(result.it, "\001");
+            break;
+    }
+    return result;
+}
+
+typedef struct {
+    Docopt__Class *class;
+    size_t class_count;
+    size_t class_cap;
+    // the frontiers of all usage lines in the layout of Docopt_Completion
+    uint64_t *state;
+    size_t state_count;
+    size_t state_cap;
+    // next[s * class_count + c] is the state after s by an element of class c, -1 if none
+    int *next;
+} Docopt__Completion_Script;
+
+void docopt__script_add_class(Docopt__Completion_Script *s, Docopt__Class_Kind kind, const char *word) {
+    for (size_t i=0; i<s->class_count; i++) {
+        if (s->class[i].kind == kind && strcmp(s->class[i].word.it, word) == 0) return;
+    }
+    if (s->class_count == s->class_cap) {
+        s->class_cap = s->class_cap == 0 ? 16 : 2 * s->class_cap;
+        s->class = realloc(s->class, s->class_cap * sizeof(Docopt__Class));
+        assert(s->class != NULL);
+    }
+    s->class[s->class_count].kind = kind;
+    s->class[s->class_count].word = docopt__make_short_string(word, strlen(word));
+    s->class_count++;
+}
+
+void docopt__script_add_leaf_classes(Docopt__Completion_Script *s, const Docopt__Leaf *leaf) {
+    switch (leaf->kind) {
+        case DOCOPT__LEAF_COMMAND:
+            docopt__script_add_class(s, DOCOPT__CLASS_WORD, leaf->node->name.it);
+            break;
+        case DOCOPT__LEAF_OPTION:
+        case DOCOPT__LEAF_OPTION_KEY:
+            {
+                const Docopt__Short_String *keys = leaf->option == NULL ? &leaf->key : leaf->option->key;
+                size_t key_count = leaf->option == NULL ? 1 : DOCOPT__OPTION_KEY_CAPACITY;
+                for (size_t k=0; k<key_count && keys[k].it[0] != '\0'; k++) {
+                    docopt__script_add_class(s, DOCOPT__CLASS_WORD, keys[k].it);
+                    if (leaf->takes_value) docopt__script_add_class(s, DOCOPT__CLASS_ATTACHED, keys[k].it);
+                }
+            }
+            break;
+        case DOCOPT__LEAF_PROGRAM:
+        case DOCOPT__LEAF_ARGUMENT:
+        case DOCOPT__LEAF_OPTION_VALUE:
+            break;
+        case DOCOPT__LEAF_KIND_COUNT:
+            assert(0);
+    }
+}
+
+int docopt__script_state(Docopt__Completion_Script *s, const uint64_t *state, size_t words) {
+    if (docopt__set_isempty(state, words)) return -1;
+    for (size_t i=0; i<s->state_count; i++) {
+        if (memcmp(s->state + i * words, state, words * sizeof(uint64_t)) == 0) return i;
+    }
+    if (s->state_count == s->state_cap) {
+        s->state_cap = s->state_cap == 0 ? 16 : 2 * s->state_cap;
+        s->state = realloc(s->state, s->state_cap * words * sizeof(uint64_t));
+        s->next = realloc(s->next, s->state_cap * s->class_count * sizeof(int));
+        assert(s->state != NULL && s->next != NULL);
+    }
+    memcpy(s->state + s->state_count * words, state, words * sizeof(uint64_t));
+    s->state_count++;
+    return s->state_count - 1;
+}
+
+// Determinizes the automata of all usage lines over the classes of argv elements.
+Docopt__Completion_Script docopt__compile_completion_script(const Docopt__Pattern *p, Docopt_Completion *c) {
+    Docopt__Completion_Script s = {0};
+    for (size_t i=0; i<p->upattern_count; i++) {
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, i);
+        for (size_t l=0; l<a->leaf_count; l++) {
+            docopt__script_add_leaf_classes(&s, &a->leaf[l]);
+        }
+    }
+    // the catch-all classes come last, the scripts test the classes in order
+    docopt__script_add_class(&s, DOCOPT__CLASS_OPTION, "");
+    docopt__script_add_class(&s, DOCOPT__CLASS_ARGUMENT, "");
+
+    size_t words = c->frame_words;
+    uint64_t *to = calloc(words, sizeof(uint64_t));
+    assert(to != NULL);
+    docopt__script_state(&s, c->frame, words);
+    for (size_t q=0; q<s.state_count; q++) {
+        for (size_t k=0; k<s.class_count; k++) {
+            Docopt__Short_String sample = docopt__class_sample(&s.class[k]);
+            Docopt__Token token = docopt__classify(sample.it);
+            for (size_t i=0; i<p->upattern_count; i++) {
+                const uint64_t *from = s.state + q * words;
+                docopt__automaton_step(docopt__pattern_automaton(p, i), from + c->offset[i], &token, to + c->offset[i], NULL);
+            }
+            // adding a state might move s.next
+            int next = docopt__script_state(&s, to, words);
+            s.next[q * s.class_count + k] = next;
+        }
+    }
+    free(to);
+    return s;
+}
+
+int docopt__script_next(const Docopt__Completion_Script *s, size_t q, size_t class) {
+    return s->next[q * s->class_count + class];
+}
+
+// The class an element of argv falls into when the scripts skip the case of
+// class, which they do if both lead to the same state. The catch-all classes
+// are the last two.
+size_t docopt__script_fallback(const Docopt__Completion_Script *s, size_t class) {
+    switch (s->class[class].kind) {
+        case DOCOPT__CLASS_WORD:
+            return docopt__is_option(s->class[class].word.it) ? s->class_count - 2 : s->class_count - 1;
+        case DOCOPT__CLASS_ATTACHED:
+            return s->class_count - 2;
+        case DOCOPT__CLASS_OPTION:
+            return s->class_count - 1;
+        case DOCOPT__CLASS_ARGUMENT:
+            return s->class_count;
+    }
+    assert(0);
+}
+
+// The words to complete in state q, without placeholders.
+// Returns whether the state also accepts other words, e.g. file names.
+bool docopt__script_words(const Docopt__Pattern *p, Docopt_Completion *c, const Docopt__Completion_Script *s, size_t q) {
+    c->word_count = 0;
+    const uint64_t *frame = s->state + q * c->frame_words;
+    for (size_t i=0; i<p->upattern_count; i++) {
+        const Docopt__Automaton *a = docopt__pattern_automaton(p, i);
+        const uint64_t *from = frame + c->offset[i];
+        size_t n = a->leaf_count;
+        for (size_t l = docopt__set_next(from, 0, n); l < n; l = docopt__set_next(from, l+1, n)) {
+            const uint64_t *follow = docopt__automaton_follow(a, l);
+            for (size_t f = docopt__set_next(follow, 0, n); f < n; f = docopt__set_next(follow, f+1, n)) {
+                docopt__completion_add_leaf(c, &a->leaf[f], "");
+            }
+        }
+    }
+    bool other = false;
+    size_t count = 0;
+    for (size_t i=0; i<c->word_count; i++) {
+        if (docopt__is_argument(c->word[i])) {
+            other = true;
+        } else {
+            c->word[count++] = c->word[i];
+        }
+    }
+    c->word_count = count;
+    return other;
+}
+
+// The case pattern of the class in state q. fish might not treat ? as wildcard,
+// there the words before the class already took the shorter options.
+void docopt__emit_class_pattern(FILE *out, size_t q, const Docopt__Class *class, bool fish) {
+    const char *any = fish ? "*" : "?*";
+    switch (class->kind) {
+        case DOCOPT__CLASS_WORD:
+            fprintf(out, "'%zu:%s'", q, class->word.it);
+            break;
+        case DOCOPT__CLASS_ATTACHED:
+            if (docopt__str_isprefix("--", class->word.it)) {
+                fprintf(out, "'%zu:%s='*", q, class->word.it);
+            } else {
+                fprintf(out, "'%zu:%s'%s", q, class->word.it, any);
+            }
+            break;
+        case DOCOPT__CLASS_OPTION:
+            fprintf(out, "'%zu:-'%s", q, any);
+            break;
+        case DOCOPT__CLASS_ARGUMENT:
+            fprintf(out, "'%zu:'*", q);
+            break;
+    }
+}
+
+void docopt__emit_words(FILE *out, const Docopt_Completion *c, const char *before, const char *after) {
+    if (c->word_count == 0) return;
+    fprintf(out, "%s", before);
+    for (size_t i=0; i<c->word_count; i++) {
+        fprintf(out, i == 0 ? "%s" : " %s", c->word[i]);
+    }
+    fprintf(out, "%s", after);
+}
+
+// Emits a completion script for bash, zsh or fish that walks the determinized
+// automata in the shell itself instead of running the program on every TAB.
+// Returns false for other shells.
+bool docopt__emit_completion(FILE *out, const Docopt__Pattern *p, const char *shell) {
+    enum { BASH, ZSH, FISH } sh;
+    if (strcmp(shell, "bash") == 0) {
+        sh = BASH;
+    } else if (strcmp(shell, "zsh") == 0) {
+        sh = ZSH;
+    } else if (strcmp(shell, "fish") == 0) {
+        sh = FISH;
+    } else {
+        return false;
+    }
+
+    assert(p->upattern_count > 0);
+    const char *program = docopt__pattern_automaton(p, 0)->leaf[0].key.it;
+    char func[DOCOPT_SHORT_STRLEN + 2] = "_";
+    for (size_t i=0; program[i] != '\0'; i++) {
+        func[i+1] = isalnum((unsigned char) program[i]) ? program[i] : '_';
+        func[i+2] = '\0';
+    }
+
+    Docopt_Completion *c = docopt_completion_new(p);
+    Docopt__Completion_Script s = docopt__compile_completion_script(p, c);
+
+    switch (sh) {
+        case BASH:
+            fprintf(out, "%s() {\n", func);
+            fprintf(out, "    local line=\"${COMP_LINE:0:COMP_POINT}\" state=0 word cur=\n");
+            fprintf(out, "    local -a words\n");
+            fprintf(out, "    read -ra words <<< \"$line\"\n");
+            fprintf(out, "    [[ $line == *[[:space:]] ]] || { cur=\"${words[-1]}\"; unset 'words[-1]'; }\n");
+            fprintf(out, "    for word in \"${words[@]:1}\"; do\n");
+            fprintf(out, "        case \"$state:$word\" in\n");
+            break;
+        case ZSH:
+            fprintf(out, "#compdef %s\n\n", program);
+            fprintf(out, "%s() {\n", func);
+            fprintf(out, "    local state=0 word\n");
+            fprintf(out, "    for word in \"${(@)words[2,CURRENT-1]}\"; do\n");
+            fprintf(out, "        case \"$state:$word\" in\n");
+            break;
+        case FISH:
+            fprintf(out, "function _%s_state\n", func);
+            fprintf(out, "    set -l state 0\n");
+            fprintf(out, "    for word in (commandline -opc)[2..-1]\n");
+            fprintf(out, "        switch \"$state:$word\"\n");
+            break;
+    }
+
+    for (size_t q=0; q<s.state_count; q++) {
+        for (size_t k=0; k<s.class_count; k++) {
+            int next = docopt__script_next(&s, q, k);
+            size_t fallback = docopt__script_fallback(&s, k);
+            if (next == (fallback < s.class_count ? docopt__script_next(&s, q, fallback) : -1)) continue;
+            if (sh == FISH) {
+                fprintf(out, "            case ");
+                docopt__emit_class_pattern(out, q, &s.class[k], true);
+                if (next < 0) {
+                    fprintf(out, "\n                echo -1\n                return\n");
+                } else {
+                    fprintf(out, "\n                set state %d\n", next);
+                }
+            } else {
+                fprintf(out, "            ");
+                docopt__emit_class_pattern(out, q, &s.class[k], false);
+                if (next < 0) {
+                    fprintf(out, ") return%s ;;\n", sh == ZSH ? " 1" : "");
+                } else {
+                    fprintf(out, ") state=%d ;;\n", next);
+                }
+            }
+        }
+    }
+
+    switch (sh) {
+        case BASH:
+            fprintf(out, "            *) return ;;\n");
+            fprintf(out, "        esac\n");
+            fprintf(out, "    done\n");
+            fprintf(out, "    case $state in\n");
+            break;
+        case ZSH:
+            fprintf(out, "            *) return 1 ;;\n");
+            fprintf(out, "        esac\n");
+            fprintf(out, "    done\n");
+            fprintf(out, "    case $state in\n");
+            break;
+        case FISH:
+            fprintf(out, "            case '*'\n");
+            fprintf(out, "                echo -1\n");
+            fprintf(out, "                return\n");
+            fprintf(out, "        end\n");
+            fprintf(out, "    end\n");
+            fprintf(out, "    echo $state\n");
+            fprintf(out, "end\n\n");
+            fprintf(out, "complete -c %s -f\n", program);
+            break;
+    }
+
+    for (size_t q=0; q<s.state_count; q++) {
+        bool other = docopt__script_words(p, c, &s, q);
+        if (c->word_count == 0 && !other) continue;
+        switch (sh) {
+            case BASH:
+                fprintf(out, "        %zu) COMPREPLY=($(compgen", q);
+                if (other) fprintf(out, " -f");
+                docopt__emit_words(out, c, " -W '", "'");
+                fprintf(out, " -- \"$cur\")) ;;\n");
+                break;
+            case ZSH:
+                fprintf(out, "        %zu)", q);
+                if (other) fprintf(out, " _files%s", c->word_count > 0 ? ";" : "");
+                docopt__emit_words(out, c, " compadd -- ", "");
+                fprintf(out, " ;;\n");
+                break;
+            case FISH:
+                fprintf(out, "complete -c %s -n 'test (_%s_state) = %zu'", program, func, q);
+                if (other) fprintf(out, " -F");
+                docopt__emit_words(out, c, " -a '", "'");
+                fprintf(out, "\n");
+                break;
+        }
+    }
+
+    switch (sh) {
+        case BASH:
+            fprintf(out, "    esac\n");
+            fprintf(out, "}\n\n");
+            fprintf(out, "complete -F %s %s\n", func, program);
+            break;
+        case ZSH:
+            fprintf(out, "    esac\n");
+            fprintf(out, "}\n\n");
+            fprintf(out, "%s \"$@\"\n", func);
+            break;
+        case FISH:
+            break;
+    }
+
+    free(s.class);
+    free(s.state);
+    free(s.next);
+    docopt_completion_free(c);
+    return true;
+}
+
+// The JSON writer either writes to a file or like snprintf to a buffer,
+// counting the bytes that did not fit.
+typedef struct {
+    FILE *file;
+    char *buffer;
+    size_t size;
+    size_t count;
+} Docopt__Writer;
+
+void docopt__write(Docopt__Writer *w, const char *str, size_t n) {
+    if (w->file != NULL) {
+        fwrite(str, 1, n, w->file);
+    } else if (w->count + 1 < w->size) {
+        size_t room = w->size - w->count - 1;
+        memcpy(w->buffer + w->count, str, n < room ? n : room);
+    }
+    w->count += n;
+}
+
+void docopt__write_str(Docopt__Writer *w, const char *str) {
+    docopt__write(w, str, strlen(str));
+}
+
+// Whether a byte needs escaping in a JSON string; NUL ends the string.
+static const bool docopt__json_escape[256] = {
+    [0x00] = 1, [0x01] = 1, [0x02] = 1, [0x03] = 1, [0x04] = 1, [0x05] = 1, [0x06] = 1, [0x07] = 1,
+    [0x08] = 1, [0x09] = 1, [0x0a] = 1, [0x0b] = 1, [0x0c] = 1, [0x0d] = 1, [0x0e] = 1, [0x0f] = 1,
+    [0x10] = 1, [0x11] = 1, [0x12] = 1, [0x13] = 1, [0x14] = 1, [0x15] = 1, [0x16] = 1, [0x17] = 1,
+    [0x18] = 1, [0x19] = 1, [0x1a] = 1, [0x1b] = 1, [0x1c] = 1, [0x1d] = 1, [0x1e] = 1, [0x1f] = 1,
+    ['"'] = 1, ['\\'] = 1,
+};
+
+// Writes the runs of bytes that need no escaping at once.
+void docopt__write_json_string_n(Docopt__Writer *w, const char *str, size_t n) {
+    docopt__write(w, "\"", 1);
+    const unsigned char *c = (const unsigned char *) str;
+    const unsigned char *end = c + n;
+    for (;;) {
+        const unsigned char *run = c;
+        while (c < end && !docopt__json_escape[*c]) c++;
+        docopt__write(w, (const char *) run, c - run);
+        if (c == end) break;
+        char escape[8];
+        switch (*c) {
+            case '"':  docopt__write(w, "\\\"", 2); break;
+            case '\\': docopt__write(w, "\\\\", 2); break;
+            case '\n': docopt__write(w, "\\n", 2); break;
+            case '\t': docopt__write(w, "\\t", 2); break;
+            case '\r': docopt__write(w, "\\r", 2); break;
+            default:
+                snprintf(escape, sizeof(escape), "\\u%04x", *c);
+                docopt__write(w, escape, 6);
+                break;
+        }
+        c++;
+    }
+    docopt__write(w, "\"", 1);
+}
+
+void docopt__write_json_string(Docopt__Writer *w, const char *str) {
+    docopt__write_json_string_n(w, str, strlen(str));
+}
+
+// The key of the i-th entry of a match as docopt reports it: commands by their name.
+const char *docopt__match_key(const Docopt_Match *m, int i) {
+    return m->kind[i] == DOCOPT_SUBCOMMAND ? m->value[i] : m->key[i];
+}
+
+// Writes the value of a key: keys without value are true or false, or their
+// count if they repeat; keys with a value are their value or null, or the
+// list of their values if they repeat. The default of an option that was
+// not given lists its words.
+void docopt__write_json_value(Docopt__Writer *w, const Docopt_Match *m, const char *key, int bit, bool valued, bool repeats) {
+    int count = 0;
+    const char *first = NULL;
+    for (int j=0; j<m->count; j++) {
+        if (m->kind[j] == DOCOPT_PROGRAM_NAME || strcmp(docopt__match_key(m, j), key) != 0) continue;
+        count += m->length[j] > 0 ? m->length[j] : 1;
+        if (first == NULL) first = m->value[j];
+    }
+    if (bit > 0 && !valued) count = m->occurrences[bit-1];
+    // the [options] shortcut accepts an option more than once
+    if (count > 1) repeats = true;
+    const char *def = bit > 0 && count == 0 ? m->option_value[bit-1].string : NULL;
+
+    if (!valued && repeats) {
+        char number[16];
+        docopt__write(w, number, snprintf(number, sizeof(number), "%d", count));
+    } else if (!valued) {
+        docopt__write_str(w, count > 0 ? "true" : "false");
+    } else if (!repeats) {
+        if (first == NULL) first = def;
+        if (first == NULL) {
+            docopt__write_str(w, "null");
+        } else {
+            docopt__write_json_string(w, first);
+        }
+    } else {
+        docopt__write(w, "[", 1);
+        bool empty = true;
+        for (int j=0; j<m->count; j++) {
+            if (m->kind[j] == DOCOPT_PROGRAM_NAME || strcmp(docopt__match_key(m, j), key) != 0) continue;
+            if (m->length[j] == 0) {
+                if (!empty) docopt__write(w, ", ", 2);
+                empty = false;
+                if (m->value[j] == NULL) {
+                    docopt__write_str(w, "null");
+                } else {
+                    docopt__write_json_string(w, m->value[j]);
+                }
+            }
+            for (int k=0; k<m->length[j]; k++) {
+                if (!empty) docopt__write(w, ", ", 2);
+                empty = false;
+                docopt__write_json_string(w, m->values[j][k]);
+            }
+        }
+        for (const char *word = def; word != NULL && *word != '\0';) {
+            size_t n = strcspn(word, " \t");
+            if (n > 0) {
+                if (!empty) docopt__write(w, ", ", 2);
+                empty = false;
+                docopt__write_json_string_n(w, word, n);
+            }
+            word += n;
+            word += strspn(word, " \t");
+        }
+        docopt__write(w, "]", 1);
+    }
+}
+
+// Writes a match the way the expectations in testcases.docopt read: a dict
+// from every key of the usage lines, in their order, and then of the Options
+// section to its value, "user-error" if argv does not match.
+void docopt__write_match_json(Docopt__Writer *w, const Docopt__Pattern *p, const Docopt_Match *m) {
+    if (m->error != NULL) {
+        docopt__write_str(w, "\"user-error\"");
+        return;
+    }
+    const Docopt__Keys *keys = docopt__pattern_keys(p);
+    docopt__write(w, "{", 1);
+    for (size_t i=0; i<keys->count; i++) {
+        const Docopt__Key *k = &keys->key[i];
+        if (i > 0) docopt__write(w, ", ", 2);
+        docopt__write_json_string(w, k->key);
+        docopt__write(w, ": ", 2);
+        docopt__write_json_value(w, m, k->key, k->bit, k->valued, k->repeats);
+    }
+    docopt__write(w, "}", 1);
+}
+
+size_t docopt_match_json(const Docopt_Pattern *pattern, const Docopt_Match *match, char *buffer, size_t size) {
+    Docopt__Writer w = {0};
+    w.buffer = buffer;
+    w.size = size;
+    docopt__write_match_json(&w, pattern, match);
+    if (size > 0) buffer[w.count < size ? w.count : size - 1] = '\0';
+    return w.count;
+}
+
+size_t docopt_match_json_file(const Docopt_Pattern *pattern, const Docopt_Match *match, FILE *file) {
+    Docopt__Writer w = {0};
+    w.file = file;
+    docopt__write_match_json(&w, pattern, match);
+    return w.count;
+}
+
+// Reads command lines from in, one per line with their elements separated by
+// NUL as with xargs -0, and writes the JSON of their match to out, one per line.
+// The buffers of the lines, argv and the matches are reused.
+void docopt__match_stream(FILE *in, FILE *out, const Docopt__Pattern *p) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    const char **args = NULL;
+    int args_cap = 0;
+    void *buffer = NULL;
+    size_t buffer_size = 0;
+    for (ssize_t n = getline(&line, &line_cap, in); n >= 0; n = getline(&line, &line_cap, in)) {
+        if (n > 0 && line[n-1] == '\n') line[--n] = '\0';
+        if (n > 0 && line[n-1] == '\0') n--;
+
+        int count = 0;
+        for (ssize_t i=0; i<=n; i++) {
+            if (i == n || line[i] == '\0') {
+                if (count + 1 >= args_cap) {
+                    args_cap = args_cap == 0 ? 16 : 2 * args_cap;
+                    args = realloc(args, args_cap * sizeof(const char *));
+                    assert(args != NULL);
+                }
+                count++;
+            }
+        }
+        const char *arg = line;
+        for (int i=0; i<count; i++) {
+            args[i] = arg;
+            arg += strlen(arg) + 1;
+        }
+
+        // the match holds the stacked short options one by one
+        size_t size = docopt_match_size(p, count, args);
+        if (size > buffer_size) {
+            free(buffer);
+            buffer_size = 2 * size;
+            buffer = malloc(buffer_size);
+            assert(buffer != NULL);
+        }
+        Docopt_Match m;
+        if (docopt_match_buffer(p, count, args, buffer, buffer_size, &m)) {
+            docopt_match_json_file(p, &m, out);
+        } else {
+            fputs("\"user-error\"", out);
+        }
+        fputc('\n', out);
+    }
+    free(buffer);
+    free(args);
+    free(line);
+}
+
+#endif // DOCOPT_IMPLEMENTATION
+
+#ifdef DOCOPT_UTILITY
+
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define DOCOPT__UTILITY_USAGE \
+    "Usage:\n" \
+    "  docopt_util c <help-file> [<name>]\n" \
+    "  docopt_util completion (bash|zsh|fish) <help-file>\n" \
+    "  docopt_util match <help-file>\n"
+
+char *docopt__read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR] Can not open file %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    size_t cap = 4096;
+    size_t count = 0;
+    char *result = malloc(cap);
+    assert(result != NULL);
+    for (size_t n = fread(result, 1, cap - count - 1, file); n > 0; n = fread(result + count, 1, cap - count - 1, file)) {
+        count += n;
+        if (count + 1 == cap) {
+            cap *= 2;
+            result = realloc(result, cap);
+            assert(result != NULL);
+        }
+    }
+    if (ferror(file)) {
+        fprintf(stderr, "[ERROR] Can not read file %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    result[count] = '\0';
+    fclose(file);
+    return result;
+}
 
 int main(int argc, const char **argv) {
-    (void) argc;
-    (void) argv;
+    if (argc >= 3 && argc <= 4 && strcmp(argv[1], "c") == 0) {
+        const char *name = argc == 4 ? argv[3] : "pattern";
+        char *help = docopt__read_file(argv[2]);
+        Docopt__Pattern p = docopt__compile_pattern(help);
+
+        printf("// Generated by docopt_util from %s.\n", argv[2]);
+        printf("// Include it after docopt.h in the file that defines DOCOPT_IMPLEMENTATION.\n\n");
+        docopt__emit_pattern(stdout, &p, name);
+
+        docopt_pattern_free(&p);
+        free(help);
+        return 0;
+    }
+
+    if (argc == 4 && strcmp(argv[1], "completion") == 0) {
+        char *help = docopt__read_file(argv[3]);
+        Docopt__Pattern p = docopt__compile_pattern(help);
+        bool ok = p.upattern_count > 0 && docopt__emit_completion(stdout, &p, argv[2]);
+        docopt_pattern_free(&p);
+        free(help);
+        if (ok) return 0;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "match") == 0) {
+        char *help = docopt__read_file(argv[2]);
+        Docopt__Pattern p = docopt__compile_pattern(help);
+        docopt__match_stream(stdin, stdout, &p);
+        docopt_pattern_free(&p);
+        free(help);
+        return 0;
+    }
 
-    fprintf(stderr, "[TODO]: utility not implemented\n");
-    abort();
+    fprintf(stderr, DOCOPT__UTILITY_USAGE);
+    return 1;
 }
 
 #endif //DOCOPT_UTILITY
@@ -2,7 +2,9 @@
 #include "docopt.h"
 
 #include "munit/munit.h"
+#include <pthread.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #define ARRAY_LEN(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -52,12 +54,8 @@ static bool opattern_equal(Docopt__OPattern p, Docopt__OPattern q) {
         munit_assert_string_equal(p.key[i].it, q.key[i].it);
     }
     munit_assert_string_equal(p.value.it, q.value.it);
-    if (p.def == NULL) {
-        munit_assert_null(q.def);
-    } else {
-        if (q.def == NULL) return false;
-        munit_assert_string_equal(p.def, q.def);
-    }
+    munit_assert_string_equal(p.def.it, q.def.it);
+    munit_assert_int(p.def_value.kind, ==, q.def_value.kind);
     return true;
 }
 
@@ -72,10 +70,12 @@ static MunitResult no_argument(const MunitParameter params[], void* user_data_or
         .head = &prog,
         .rest = NULL,
     };
-    Docopt__UPattern p = docopt__compile_upattern(in);
+    Docopt__Arena arena = {0};
+    Docopt__UPattern p = docopt__compile_upattern(&arena, in);
 
     munit_assert(upattern_equal(expect, p));
 
+    docopt__arena_free(&arena);
     return MUNIT_OK;
 }
 
@@ -106,9 +106,11 @@ static MunitResult command(const MunitParameter params[], void *user_data_or_fix
         .rest = &body,
     };
 
-    Docopt__UPattern p = docopt__compile_upattern(in);
+    Docopt__Arena arena = {0};
+    Docopt__UPattern p = docopt__compile_upattern(&arena, in);
     munit_assert(upattern_equal(expect, p));
 
+    docopt__arena_free(&arena);
     return MUNIT_OK;
 }
 
@@ -138,9 +140,11 @@ static MunitResult argument(const MunitParameter params[], void *user_data_or_fi
         .rest = &body,
     };
 
-    Docopt__UPattern p = docopt__compile_upattern(in);
+    Docopt__Arena arena = {0};
+    Docopt__UPattern p = docopt__compile_upattern(&arena, in);
     munit_assert(upattern_equal(expect, p));
 
+    docopt__arena_free(&arena);
     return MUNIT_OK;
 }
 
@@ -168,9 +172,11 @@ static MunitResult option_simple(const MunitParameter params[], void *user_data_
         .rest = &body,
     };
 
-    Docopt__UPattern p = docopt__compile_upattern(in);
+    Docopt__Arena arena = {0};
+    Docopt__UPattern p = docopt__compile_upattern(&arena, in);
     munit_assert(upattern_equal(expect, p));
 
+    docopt__arena_free(&arena);
     return MUNIT_OK;
 }
 
@@ -219,10 +225,12 @@ static MunitResult optional_elem(const MunitParameter params[], void *user_data_
         .rest = &body,
     };
 
-    Docopt__UPattern p = docopt__compile_upattern(in);
+    Docopt__Arena arena = {0};
+    Docopt__UPattern p = docopt__compile_upattern(&arena, in);
 
     munit_assert(upattern_equal(expect, p));
 
+    docopt__arena_free(&arena);
     return MUNIT_OK;
 }
 
@@ -283,9 +291,11 @@ static MunitResult exclusive(const MunitParameter params[], void *user_data_or_f
         .rest = &body,
     };
 
-    Docopt__UPattern p = docopt__compile_upattern(in);
+    Docopt__Arena arena = {0};
+    Docopt__UPattern p = docopt__compile_upattern(&arena, in);
     munit_assert(upattern_equal(expect, p));
 
+    docopt__arena_free(&arena);
     return MUNIT_OK;
 }
 
@@ -318,9 +328,63 @@ static MunitResult repeat(const MunitParameter params[], void *user_data_or_fixt
         .rest = &body,
     };
 
-    Docopt__UPattern p = docopt__compile_upattern(in);
+    Docopt__Arena arena = {0};
+    Docopt__UPattern p = docopt__compile_upattern(&arena, in);
     munit_assert(upattern_equal(expect, p));
 
+    docopt__arena_free(&arena);
+    return MUNIT_OK;
+}
+
+static MunitResult simplify(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char *in = "my_program ((go) [<x>] (a b))";
+    Docopt__UPattern prog = {.kind = DOCOPT__UPATTERN_SIMPLE, .name = {"my_program"}};
+    Docopt__UPattern go = {.kind = DOCOPT__UPATTERN_SIMPLE, .name = {"go"}};
+    Docopt__UPattern x = {.kind = DOCOPT__UPATTERN_SIMPLE, .name = {"<x>"}};
+    Docopt__UPattern a = {.kind = DOCOPT__UPATTERN_SIMPLE, .name = {"a"}};
+    Docopt__UPattern b = {.kind = DOCOPT__UPATTERN_SIMPLE, .name = {"b"}};
+
+    // the last element of a sequence is no group of its own
+    Docopt__UPattern tail2 = {
+        .kind = DOCOPT__UPATTERN_GROUP,
+        .head = &a,
+        .rest = &b,
+    };
+
+    Docopt__UPattern optional = {
+        .kind = DOCOPT__UPATTERN_GROUP,
+        .optional = true,
+        .head = &x,
+        .rest = NULL,
+    };
+
+    Docopt__UPattern tail = {
+        .kind = DOCOPT__UPATTERN_GROUP,
+        .head = &optional,
+        .rest = &tail2,
+    };
+
+    Docopt__UPattern body = {
+        .kind = DOCOPT__UPATTERN_GROUP,
+        .head = &go,
+        .rest = &tail,
+    };
+
+    Docopt__UPattern expect = {
+        .kind = DOCOPT__UPATTERN_ROOT,
+        .head = &prog,
+        .rest = &body,
+    };
+
+    Docopt__Arena arena = {0};
+    Docopt__UPattern parsed = docopt__compile_upattern(&arena, in);
+    Docopt__UPattern p = docopt__simplify_upattern(&arena, &parsed);
+    munit_assert(upattern_equal(expect, p));
+
+    docopt__arena_free(&arena);
     return MUNIT_OK;
 }
 
@@ -414,36 +478,50 @@ static MunitResult option_default(const MunitParameter params[], void *user_data
     Docopt__OPattern expect = {
         .key[0] = {"--coefficient"},
         .value = {"K"},
-        .def = "2.95",
+        .def = {"2.95"},
+        .def_value = {.kind = DOCOPT_VALUE_DOUBLE},
     };
 
     Docopt__OPattern p = docopt__compile_opattern(in);
     munit_assert(opattern_equal(expect, p));
+    munit_assert_double(p.def_value.f64, ==, 2.95);
+
+    p = docopt__compile_opattern("-n N  Count [Default: 10].");
+    munit_assert_string_equal(p.def.it, "10");
+    munit_assert_int(p.def_value.kind, ==, DOCOPT_VALUE_INT);
+    munit_assert_int(p.def_value.i64, ==, 10);
+
+    p = docopt__compile_opattern("--out=FILE  Output [default: ./a.out]");
+    munit_assert_int(p.def_value.kind, ==, DOCOPT_VALUE_STRING);
+    p = docopt__compile_opattern("--color=B  Color [default: true]");
+    munit_assert_int(p.def_value.kind, ==, DOCOPT_VALUE_BOOL);
+    munit_assert_true(p.def_value.b);
 
     return MUNIT_OK;
 }
 
+static const char naval_fate[] =
+    "Naval Fate.\n"
+    "\n"
+    "Usage:\n"
+    "  naval_fate ship create <name>...\n"
+    "  naval_fate ship <name> move <x> <y> [--speed=<kn>]\n"
+    "  naval_fate ship shoot <x> <y>\n"
+    "  naval_fate mine (set|remove) <x> <y> [--moored|--drifting]\n"
+    "  naval_fate --help\n"
+    "  naval_fate --version\n"
+    "\n"
+    "Options:\n"
+    "  -h --help     Show this screen.\n"
+    "  --version     Show version.\n"
+    "  --speed=<kn>  Speed in knots [default: 10].\n"
+    "  --moored      Moored (anchored) mine.\n"
+    "  --drifting    Drifting mine.\n";
+
 static MunitResult interpret(const MunitParameter params[], void *user_data_or_fixture) {
     (void) params;
     (void) user_data_or_fixture;
 
-    const char help_message[] = 
-        "Naval Fate.\n"
-        "\n"
-        "Usage:\n"
-        "  naval_fate ship create <name>...\n"
-        "  naval_fate ship <name> move <x> <y> [--speed=<kn>]\n"
-        "  naval_fate ship shoot <x> <y>\n"
-        "  naval_fate mine (set|remove) <x> <y> [--moored|--drifting]\n"
-        "  naval_fate --help\n"
-        "  naval_fate --version\n"
-        "\n"
-        "Options:\n"
-        "  -h --help     Show this screen.\n"
-        "  --version     Show version.\n"
-        "  --speed=<kn>  Speed in knots [default: 10].\n"
-        "  --moored      Moored (anchored) mine.\n"
-        "  --drifting    Drifting mine.\n";
     const char *argv[] = {
         "naval_fate",
         "ship",
@@ -453,8 +531,8 @@ static MunitResult interpret(const MunitParameter params[], void *user_data_or_f
     };
     int argc = ARRAY_LEN(argv);
 
-    Docopt_Match m = docopt_interpret(help_message, argc, argv);
-    munit_assert_int(m.count, ==, 5);
+    Docopt_Match m = docopt_interpret(naval_fate, argc, argv);
+    munit_assert_int(m.count, ==, 4);
 
     munit_assert_int(m.kind[0], ==, DOCOPT_PROGRAM_NAME);
     munit_assert_string_equal(m.value[0], "naval_fate");
@@ -469,10 +547,1225 @@ static MunitResult interpret(const MunitParameter params[], void *user_data_or_f
     munit_assert_string_equal(m.key[3], "<name>");
     munit_assert_string_equal(m.value[3], "beagle");
 
-    munit_assert_int(m.kind[4], ==, DOCOPT_ARGUMENT);
-    munit_assert_string_equal(m.key[4], "<name>");
-    munit_assert_string_equal(m.value[4], "enterprise");
+    // the repeated argument is a single entry pointing into argv
+    munit_assert_int(m.length[3], ==, 2);
+    munit_assert_ptr_equal(m.values[3], &argv[3]);
+    munit_assert_int(m.length[1], ==, 1);
+    munit_assert_string_equal(m.values[1][0], "ship");
 
+    docopt_match_free(&m);
+    return MUNIT_OK;
+}
+
+static bool has_option(const Docopt_Match *m, const Docopt_Pattern *p, const char *key) {
+    int bit = docopt_option_bit(p, key);
+    munit_assert_int(bit, >=, 0);
+    return m->options[bit / 64] >> (bit % 64) & 1;
+}
+
+static MunitResult interpret_options(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    Docopt_Pattern *p = docopt_compile(naval_fate);
+
+    const char *argv1[] = {"naval_fate", "mine", "remove", "1", "2", "--drifting"};
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv1), argv1);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 5);
+    munit_assert_string_equal(m.value[2], "remove");
+    munit_assert_true(has_option(&m, p, "--drifting"));
+    munit_assert_false(has_option(&m, p, "--moored"));
+    munit_assert_int(m.option_count, ==, 5);
+    // options not given take their default
+    Docopt_Value speed = m.option_value[docopt_option_bit(p, "--speed")];
+    munit_assert_int(speed.kind, ==, DOCOPT_VALUE_INT);
+    munit_assert_int(speed.i64, ==, 10);
+    munit_assert_string_equal(speed.string, "10");
+    docopt_match_free(&m);
+
+    const char *argv2[] = {"naval_fate", "ship", "beagle", "move", "1", "2", "--speed=20"};
+    m = docopt_match(p, ARRAY_LEN(argv2), argv2);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 7);
+    munit_assert_string_equal(m.key[6], "--speed");
+    munit_assert_string_equal(m.value[6], "20");
+    munit_assert_true(has_option(&m, p, "--speed"));
+    speed = m.option_value[docopt_option_bit(p, "--speed")];
+    munit_assert_int(speed.kind, ==, DOCOPT_VALUE_STRING);
+    munit_assert_string_equal(speed.string, "20");
+    docopt_match_free(&m);
+
+    const char *argv3[] = {"naval_fate", "ship", "beagle", "move", "1", "2", "--speed", "30"};
+    m = docopt_match(p, ARRAY_LEN(argv3), argv3);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 7);
+    munit_assert_string_equal(m.key[6], "--speed");
+    munit_assert_string_equal(m.value[6], "30");
+    docopt_match_free(&m);
+
+    const char *argv4[] = {"naval_fate", "-h"};
+    m = docopt_match(p, ARRAY_LEN(argv4), argv4);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 1);
+    munit_assert_true(has_option(&m, p, "--help"));
+    munit_assert_int(docopt_option_bit(p, "-h"), ==, docopt_option_bit(p, "--help"));
+    munit_assert_int(docopt_option_bit(p, "--unknown"), ==, -1);
+    docopt_match_free(&m);
+
+    const char *argv5[] = {"naval_fate", "ship", "shoot", "1"};
+    m = docopt_match(p, ARRAY_LEN(argv5), argv5);
+    munit_assert_not_null(m.error);
+    munit_assert_int(m.count, ==, 0);
+    docopt_match_free(&m);
+
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult passthrough(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog [options] -- <cmd>...\n"
+        "\n"
+        "Options:\n"
+        "  -v  Verbose.\n";
+    const char *argv[] = {"prog", "-v", "--", "ls", "-l", "--", "x"};
+
+    Docopt_Pattern *p = docopt_compile(help_message);
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 3);
+    munit_assert_true(has_option(&m, p, "-v"));
+    munit_assert_string_equal(m.key[2], "<cmd>");
+    munit_assert_ptr_equal(m.values[2], &argv[3]);
+    munit_assert_int(m.length[2], ==, 4);
+    docopt_match_free(&m);
+
+    const char *nothing[] = {"prog", "--"};
+    m = docopt_match(p, ARRAY_LEN(nothing), nothing);
+    munit_assert_not_null(m.error);
+    docopt_match_free(&m);
+
+    // the matcher neither splits nor looks up options after --
+    const char *stack[] = {"prog", "-v", "--", "ls", "-vla"};
+    Docopt_Matcher *matcher = docopt_matcher_new(p);
+    for (size_t i=0; i<ARRAY_LEN(stack); i++) {
+        munit_assert_true(docopt_feed(matcher, stack[i]));
+    }
+    m = docopt_matcher_match(matcher);
+    munit_assert_null(m.error);
+    munit_assert_true(has_option(&m, p, "-v"));
+    munit_assert_string_equal(m.key[m.count-1], "<cmd>");
+    munit_assert_string_equal(m.values[m.count-1][m.length[m.count-1]-1], "-vla");
+    docopt_match_free(&m);
+    docopt_matcher_free(matcher);
+    docopt_pattern_free(p);
+
+    // without a usage line to pass them through, the elements after -- are
+    // still positional, for docopt_match as for the matcher
+    const char *patterns[] = {"Usage: rm [-f] [--] <file>\n", "Usage: prog [-- <arg>]\n"};
+    const char *dashed[][3] = {{"rm", "--", "-f"}, {"prog", "--", "-x"}};
+    for (size_t i=0; i<ARRAY_LEN(patterns); i++) {
+        p = docopt_compile(patterns[i]);
+        m = docopt_match(p, 3, dashed[i]);
+        munit_assert_null(m.error);
+        munit_assert_string_equal(m.value[m.count-1], dashed[i][2]);
+        docopt_match_free(&m);
+
+        matcher = docopt_matcher_new(p);
+        for (size_t j=0; j<3; j++) munit_assert_true(docopt_feed(matcher, dashed[i][j]));
+        m = docopt_matcher_match(matcher);
+        munit_assert_null(m.error);
+        munit_assert_string_equal(m.value[m.count-1], dashed[i][2]);
+        docopt_match_free(&m);
+        docopt_matcher_free(matcher);
+        docopt_pattern_free(p);
+    }
+    return MUNIT_OK;
+}
+
+static MunitResult options_first(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  git [options] <command> [<args>...]\n"
+        "\n"
+        "Options:\n"
+        "  -C <path>  Run as if started in path.\n"
+        "  --bare     Treat the repository as bare.\n";
+    const char *argv[] = {"git", "-C", "/x", "commit", "-m", "msg", "--bare"};
+
+    Docopt_Pattern *p = docopt_compile(help_message);
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_not_null(m.error);
+    docopt_match_free(&m);
+    docopt_pattern_free(p);
+
+    p = docopt_compile_ex(help_message, DOCOPT_OPTIONS_FIRST);
+    m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 4);
+    munit_assert_string_equal(m.key[1], "-C");
+    munit_assert_string_equal(m.value[1], "/x");
+    munit_assert_string_equal(m.key[2], "<command>");
+    munit_assert_string_equal(m.value[2], "commit");
+    munit_assert_string_equal(m.key[3], "<args>");
+    munit_assert_ptr_equal(m.values[3], &argv[4]);
+    munit_assert_int(m.length[3], ==, 3);
+    docopt_match_free(&m);
+
+    const char *bare[] = {"git", "--bare", "status"};
+    m = docopt_match(p, ARRAY_LEN(bare), bare);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 2);
+    munit_assert_true(has_option(&m, p, "--bare"));
+    munit_assert_string_equal(m.value[1], "status");
+    docopt_match_free(&m);
+
+    // the matcher and completion take the elements after the command as arguments too
+    Docopt_Matcher *matcher = docopt_matcher_new(p);
+    for (size_t i=0; i<ARRAY_LEN(argv); i++) {
+        munit_assert_true(docopt_feed(matcher, argv[i]));
+    }
+    m = docopt_matcher_match(matcher);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 4);
+    munit_assert_string_equal(m.value[2], "commit");
+    munit_assert_int(m.length[3], ==, 3);
+    docopt_match_free(&m);
+    docopt_matcher_free(matcher);
+
+    const char *line[] = {"git", "-C", "/x", "commit", "-m", ""};
+    const char **words;
+    Docopt_Completion *c = docopt_completion_new(p);
+    munit_assert_int(docopt_complete(c, ARRAY_LEN(line), line, &words), ==, 1);
+    munit_assert_string_equal(words[0], "<args>");
+    docopt_completion_free(c);
+
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult stacked(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  tar [options] <file>...\n"
+        "\n"
+        "Options:\n"
+        "  -v         Verbose.\n"
+        "  -x         Extract.\n"
+        "  -f <file>  Archive.\n";
+    const char *argv[] = {"tar", "-xvfout.tar", "-v", "a", "-vx"};
+
+    Docopt_Pattern *p = docopt_compile(help_message);
+    Docopt_Match m = docopt_match(p, 4, argv);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 3);
+    munit_assert_true(has_option(&m, p, "-x"));
+    munit_assert_true(has_option(&m, p, "-v"));
+    munit_assert_string_equal(m.key[1], "-f");
+    munit_assert_string_equal(m.value[1], "out.tar");
+    munit_assert_string_equal(m.value[2], "a");
+    docopt_match_free(&m);
+
+    // not an option after the first argument
+    m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_not_null(m.error);
+    docopt_match_free(&m);
+
+    // the program name is no stack even if it looks like one
+    const char *name[] = {"-xv", "-xv", "a"};
+    m = docopt_match(p, ARRAY_LEN(name), name);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 2);
+    munit_assert_string_equal(m.value[0], "-xv");
+    munit_assert_string_equal(m.value[1], "a");
+    docopt_match_free(&m);
+
+    // the values of arguments and passthroughs point into argv, not at its expansion
+    const char *slice[] = {"tar", "-xvfout.tar", "a", "b"};
+    m = docopt_match(p, ARRAY_LEN(slice), slice);
+    munit_assert_null(m.error);
+    munit_assert_string_equal(m.key[2], "<file>");
+    munit_assert_ptr_equal(m.values[2], &slice[2]);
+    munit_assert_int(m.length[2], ==, 2);
+    docopt_match_free(&m);
+
+    const char passthrough_message[] =
+        "Usage:\n"
+        "  tar [options] -- <cmd>...\n"
+        "\n"
+        "Options:\n"
+        "  -v  Verbose.\n"
+        "  -x  Extract.\n";
+    Docopt_Pattern *q = docopt_compile(passthrough_message);
+    const char *tail[] = {"tar", "-xv", "--", "ls", "-l"};
+    m = docopt_match(q, ARRAY_LEN(tail), tail);
+    munit_assert_null(m.error);
+    munit_assert_true(has_option(&m, q, "-x"));
+    munit_assert_string_equal(m.key[m.count-1], "<cmd>");
+    munit_assert_ptr_equal(m.values[m.count-1], &tail[3]);
+    munit_assert_int(m.length[m.count-1], ==, 2);
+    docopt_match_free(&m);
+    docopt_pattern_free(q);
+
+    // unknown short options are not split
+    const char *unknown[] = {"tar", "-vq", "a"};
+    m = docopt_match(p, ARRAY_LEN(unknown), unknown);
+    munit_assert_not_null(m.error);
+    docopt_match_free(&m);
+
+    Docopt_Matcher *matcher = docopt_matcher_new(p);
+    munit_assert_true(docopt_feed(matcher, "tar"));
+    munit_assert_true(docopt_feed(matcher, "-vf"));
+    munit_assert_true(docopt_feed(matcher, "out.tar"));
+    munit_assert_true(docopt_feed(matcher, "a"));
+    m = docopt_matcher_match(matcher);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 3);
+    munit_assert_true(has_option(&m, p, "-v"));
+    munit_assert_false(has_option(&m, p, "-x"));
+    munit_assert_string_equal(m.value[1], "out.tar");
+    docopt_match_free(&m);
+    docopt_matcher_free(matcher);
+
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult repeated_options(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog [options] <file>\n"
+        "\n"
+        "Options:\n"
+        "  -v                         Verbose.\n"
+        "  -I <dir>, --include=<dir>  Include.\n";
+    const char *argv[] = {"prog", "-vvv", "-I", "a", "--include=b", "-Ic", "x"};
+
+    Docopt_Pattern *p = docopt_compile(help_message);
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 3);
+    munit_assert_int(m.occurrences[docopt_option_bit(p, "-v")], ==, 3);
+    munit_assert_int(m.occurrences[docopt_option_bit(p, "-I")], ==, 3);
+    munit_assert_string_equal(m.key[1], "--include");
+    munit_assert_int(m.length[1], ==, 3);
+    munit_assert_string_equal(m.value[1], "a");
+    munit_assert_string_equal(m.values[1][0], "a");
+    munit_assert_string_equal(m.values[1][1], "b");
+    munit_assert_string_equal(m.values[1][2], "c");
+    munit_assert_string_equal(m.value[2], "x");
+
+    const char expect[] = "{\"-v\": 3, \"--include\": [\"a\", \"b\", \"c\"], \"<file>\": \"x\"}";
+    char buf[sizeof(expect)];
+    munit_assert_size(docopt_match_json(p, &m, buf, sizeof(buf)), ==, strlen(expect));
+    munit_assert_string_equal(buf, expect);
+    docopt_match_free(&m);
+
+    // the lists of values fit into the bound of docopt_match_size,
+    // -vvv and -Ic count as the five elements they expand to
+    size_t size = docopt_match_size(p, ARRAY_LEN(argv), argv);
+    void *buffer = malloc(size);
+    munit_assert_true(docopt_match_buffer(p, ARRAY_LEN(argv), argv, buffer, size, &m));
+    munit_assert_null(m.error);
+    munit_assert_int(m.length[1], ==, 3);
+    free(buffer);
+
+    const char *once[] = {"prog", "-v", "--include", "a", "x"};
+    m = docopt_match(p, ARRAY_LEN(once), once);
+    munit_assert_null(m.error);
+    munit_assert_int(m.occurrences[docopt_option_bit(p, "-v")], ==, 1);
+    munit_assert_int(m.length[1], ==, 1);
+    munit_assert_ptr_equal(m.values[1], &m.value[1]);
+    munit_assert_string_equal(m.value[1], "a");
+    docopt_match_free(&m);
+
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult typed(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog [options] <count>\n"
+        "\n"
+        "Options:\n"
+        "  --ratio=R    Ratio [default: 0.25].\n"
+        "  --limit=N    Limit [default: -42].\n"
+        "  --timeout=T  Timeout [default: 1h30m].\n"
+        "  --max=S      Maximum size.\n";
+    const char *argv[] = {"prog", "--max=10M", "--ratio=1e3", "9223372036854775807"};
+
+    Docopt_Pattern *p = docopt_compile(help_message);
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_null(m.error);
+
+    int64_t i;
+    double f;
+    uint64_t size;
+    munit_assert_true(docopt_get_i64(&m, "<count>", &i));
+    munit_assert_int64(i, ==, INT64_MAX);
+    munit_assert_true(docopt_get_i64(&m, "--limit", &i));
+    munit_assert_int64(i, ==, -42);
+    munit_assert_true(docopt_get_f64(&m, "--ratio", &f));
+    munit_assert_double(f, ==, 1000);
+    munit_assert_true(docopt_get_f64(&m, "--limit", &f));
+    munit_assert_double(f, ==, -42);
+    munit_assert_false(docopt_get_i64(&m, "--ratio", &i));
+    munit_assert_true(docopt_get_duration(&m, "--timeout", &i));
+    munit_assert_int64(i, ==, 5400000);
+    munit_assert_true(docopt_get_size(&m, "--max", &size));
+    munit_assert_uint64(size, ==, 10 << 20);
+    munit_assert_false(docopt_get_size(&m, "--missing", &size));
+    docopt_match_free(&m);
+
+    const char *overflow[] = {"prog", "--max=16E", "9223372036854775808"};
+    m = docopt_match(p, ARRAY_LEN(overflow), overflow);
+    munit_assert_null(m.error);
+    munit_assert_false(docopt_get_i64(&m, "<count>", &i));
+    munit_assert_true(docopt_get_f64(&m, "<count>", &f));
+    munit_assert_double(f, ==, 9223372036854775808.0);
+    munit_assert_false(docopt_get_size(&m, "--max", &size));
+    docopt_match_free(&m);
+
+    int64_t ms;
+    munit_assert_not_null(docopt__parse_duration("250ms", &ms));
+    munit_assert_int64(ms, ==, 250);
+    munit_assert_not_null(docopt__parse_duration("1.5", &ms));
+    munit_assert_int64(ms, ==, 1500);
+    munit_assert_null(docopt__parse_duration("s", &ms));
+    munit_assert_null(docopt__parse_duration("1s2", &ms));
+    munit_assert_not_null(docopt__parse_size("2GiB", &size));
+    munit_assert_uint64(size, ==, (uint64_t) 2 << 30);
+    munit_assert_not_null(docopt__parse_f64("0.1", &f));
+    munit_assert_double(f, ==, 0.1);
+    munit_assert_not_null(docopt__parse_f64("1.7976931348623157e308", &f));
+    munit_assert_double(f, ==, 1.7976931348623157e308);
+    munit_assert_null(docopt__parse_f64("1e400", &f));
+    munit_assert_null(docopt__parse_i64("-", &i));
+
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult environment(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog [options]\n"
+        "\n"
+        "Options:\n"
+        "  --speed=KN  Speed [env: DOCOPT_TEST_SPEED] [default: 10].\n"
+        "  --name=N    Name [env: DOCOPT_TEST_NAME].\n";
+    const char *argv[] = {"prog"};
+
+    Docopt__OPattern o = docopt__compile_opattern("--speed=KN  Speed [env: DOCOPT_TEST_SPEED] [default: 10].");
+    munit_assert_string_equal(o.env.it, "DOCOPT_TEST_SPEED");
+    munit_assert_string_equal(o.def.it, "10");
+
+    setenv("DOCOPT_TEST_SPEED", "30", 1);
+    unsetenv("DOCOPT_TEST_NAME");
+    Docopt_Pattern *p = docopt_compile(help_message);
+    // the environment is read once by docopt_compile
+    setenv("DOCOPT_TEST_SPEED", "40", 1);
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_null(m.error);
+    int64_t speed;
+    munit_assert_true(docopt_get_i64(&m, "--speed", &speed));
+    munit_assert_int64(speed, ==, 30);
+    munit_assert_int(m.option_value[docopt_option_bit(p, "--name")].kind, ==, DOCOPT_VALUE_NONE);
+    docopt_match_free(&m);
+
+    const char *given[] = {"prog", "--speed=50"};
+    m = docopt_match(p, ARRAY_LEN(given), given);
+    munit_assert_true(docopt_get_i64(&m, "--speed", &speed));
+    munit_assert_int64(speed, ==, 50);
+    docopt_match_free(&m);
+    docopt_pattern_free(p);
+
+    // without docopt_compile every match reads the environment
+    m = docopt_interpret(help_message, ARRAY_LEN(argv), argv);
+    munit_assert_true(docopt_get_i64(&m, "--speed", &speed));
+    munit_assert_int64(speed, ==, 40);
+    docopt_match_free(&m);
+
+    unsetenv("DOCOPT_TEST_SPEED");
+    m = docopt_interpret(help_message, ARRAY_LEN(argv), argv);
+    munit_assert_true(docopt_get_i64(&m, "--speed", &speed));
+    munit_assert_int64(speed, ==, 10);
+    docopt_match_free(&m);
+    return MUNIT_OK;
+}
+
+static MunitResult tokens(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    Docopt__Token t = docopt__classify("--speed=10");
+    munit_assert_int(t.kind, ==, DOCOPT__TOKEN_LONG);
+    munit_assert_size(t.name_length, ==, strlen("--speed"));
+    munit_assert_string_equal(t.value, "10");
+    munit_assert_uint64(t.hash, ==, docopt__hash("--speed", strlen("--speed")));
+    munit_assert_uint64(t.hash, !=, docopt__classify("--speedy").hash);
+    t = docopt__classify("-ofile");
+    munit_assert_int(t.kind, ==, DOCOPT__TOKEN_SHORT);
+    munit_assert_string_equal(t.value, "file");
+    munit_assert_int(docopt__classify("-").kind, ==, DOCOPT__TOKEN_DASH);
+    munit_assert_int(docopt__classify("--").kind, ==, DOCOPT__TOKEN_DASHDASH);
+    munit_assert_int(docopt__classify("a=b").kind, ==, DOCOPT__TOKEN_POSITIONAL);
+
+    // elements are classified in order and only up to the one asked for
+    const char *tail[] = {"prog", "--", "-x", "y"};
+    Docopt__Token token[ARRAY_LEN(tail)];
+    Docopt__Tokens tokens = {.argv = tail, .token = token, .positional = 1};
+    munit_assert_int(docopt__token(&tokens, 1)->kind, ==, DOCOPT__TOKEN_DASHDASH);
+    munit_assert_int(tokens.classified, ==, 2);
+    munit_assert_int(docopt__token(&tokens, 0)->kind, ==, DOCOPT__TOKEN_POSITIONAL);
+    munit_assert_int(tokens.classified, ==, 2);
+    // the elements after -- are positional
+    munit_assert_int(docopt__token(&tokens, 2)->kind, ==, DOCOPT__TOKEN_POSITIONAL);
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog [--speed=<kn>] [-o <file>] <input>\n"
+        "\n"
+        "Options:\n"
+        "  --speed=<kn>  Speed.\n"
+        "  -o <file>     Output.\n";
+    Docopt_Pattern *p = docopt_compile(help_message);
+
+    const char *argv[] = {"prog", "--speed=10", "-oout", "-"};
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 4);
+    munit_assert_string_equal(m.value[1], "10");
+    munit_assert_string_equal(m.value[2], "out");
+    munit_assert_string_equal(m.value[3], "-");
+    docopt_match_free(&m);
+
+    // the name of a long option ends at =, not at the key
+    const char *prefix[] = {"prog", "--speedy=10", "a"};
+    m = docopt_match(p, ARRAY_LEN(prefix), prefix);
+    munit_assert_not_null(m.error);
+    docopt_match_free(&m);
+
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult ll1(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    Docopt_Pattern *p = docopt_compile(naval_fate);
+    for (size_t i=0; i<p->upattern_count; i++) {
+        munit_assert_true(docopt__pattern_automaton(p, i)->ll1);
+    }
+    const char *argv[] = {"naval_fate", "ship", "beagle", "move", "1", "2", "--speed=30"};
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 7);
+    munit_assert_string_equal(m.value[2], "beagle");
+    munit_assert_string_equal(m.value[6], "30");
+    docopt_match_free(&m);
+    docopt_pattern_free(p);
+
+    // whether <a> is given is only known at the end, so these need the frontier
+    const char help_message[] =
+        "Usage:\n"
+        "  prog [<a>] <b>\n"
+        "  prog (go | <y>) -v\n"
+        "\n"
+        "Options:\n"
+        "  -v  Verbose.\n";
+    p = docopt_compile(help_message);
+    munit_assert_false(docopt__pattern_automaton(p, 0)->ll1);
+    munit_assert_false(docopt__pattern_automaton(p, 1)->ll1);
+
+    const char *one[] = {"prog", "x"};
+    m = docopt_match(p, ARRAY_LEN(one), one);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 2);
+    munit_assert_string_equal(m.key[1], "<b>");
+    docopt_match_free(&m);
+
+    const char *go[] = {"prog", "go", "-v"};
+    m = docopt_match(p, ARRAY_LEN(go), go);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 2);
+    munit_assert_null(m.key[1]);
+    munit_assert_string_equal(m.value[1], "go");
+    munit_assert_true(has_option(&m, p, "-v"));
+    docopt_match_free(&m);
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult feed(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    Docopt_Pattern *p = docopt_compile(naval_fate);
+
+    Docopt_Matcher *matcher = docopt_matcher_new(p);
+    const char *argv[] = {"naval_fate", "ship", "beagle", "move", "1", "2", "--speed", "30"};
+    char token[16];
+    for (size_t i=0; i<ARRAY_LEN(argv); i++) {
+        // the matcher must not depend on the caller's buffer
+        strcpy(token, argv[i]);
+        munit_assert_true(docopt_feed(matcher, token));
+    }
+    Docopt_Match m = docopt_matcher_match(matcher);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 7);
+    munit_assert_string_equal(m.value[2], "beagle");
+    munit_assert_string_equal(m.key[6], "--speed");
+    munit_assert_string_equal(m.value[6], "30");
+    docopt_match_free(&m);
+    docopt_matcher_free(matcher);
+
+    matcher = docopt_matcher_new(p);
+    munit_assert_true(docopt_feed(matcher, "naval_fate"));
+    munit_assert_true(docopt_feed(matcher, "mine"));
+    m = docopt_matcher_match(matcher);
+    munit_assert_not_null(m.error);
+    docopt_match_free(&m);
+    munit_assert_false(docopt_feed(matcher, "move"));
+    docopt_matcher_free(matcher);
+    docopt_pattern_free(p);
+
+    // once no line can match, more elements than fit the first buffers are refused
+    p = docopt_compile("Usage: prog add <x>\n       prog rm <x>\n");
+    matcher = docopt_matcher_new(p);
+    munit_assert_true(docopt_feed(matcher, "prog"));
+    for (int i=0; i<40; i++) munit_assert_false(docopt_feed(matcher, "bogus"));
+    m = docopt_matcher_match(matcher);
+    munit_assert_not_null(m.error);
+    docopt_match_free(&m);
+    docopt_matcher_free(matcher);
+
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult feed_expand(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    char path[] = "/tmp/docopt_test_XXXXXX";
+    int fd = mkstemp(path);
+    munit_assert_int(fd, >=, 0);
+    const char content[] = "create\r\nenterprise\n\nbeagle";
+    munit_assert_int(write(fd, content, strlen(content)), ==, strlen(content));
+    close(fd);
+    char arg[sizeof(path) + 1] = "@";
+    strcat(arg, path);
+
+    Docopt_Pattern *p = docopt_compile(naval_fate);
+    Docopt_Matcher *matcher = docopt_matcher_new(p);
+    munit_assert_true(docopt_feed_expand(matcher, "naval_fate"));
+    munit_assert_true(docopt_feed_expand(matcher, "ship"));
+    munit_assert_true(docopt_feed_expand(matcher, arg));
+    Docopt_Match m = docopt_matcher_match(matcher);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 4);
+    munit_assert_string_equal(m.value[2], "create");
+    munit_assert_int(m.length[3], ==, 2);
+    munit_assert_string_equal(m.values[3][0], "enterprise");
+    munit_assert_string_equal(m.values[3][1], "beagle");
+    docopt_match_free(&m);
+    docopt_matcher_free(matcher);
+    unlink(path);
+
+    // a pipe has no size and is read until its end, like @<(printf ...)
+    int pipes[2];
+    munit_assert_int(pipe(pipes), ==, 0);
+    munit_assert_int(write(pipes[1], content, strlen(content)), ==, strlen(content));
+    close(pipes[1]);
+    char fd_arg[32];
+    snprintf(fd_arg, sizeof(fd_arg), "@/dev/fd/%d", pipes[0]);
+    matcher = docopt_matcher_new(p);
+    munit_assert_true(docopt_feed_expand(matcher, "naval_fate"));
+    munit_assert_true(docopt_feed_expand(matcher, "ship"));
+    munit_assert_true(docopt_feed_expand(matcher, fd_arg));
+    close(pipes[0]);
+    m = docopt_matcher_match(matcher);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 4);
+    munit_assert_string_equal(m.values[3][1], "beagle");
+    docopt_match_free(&m);
+    docopt_matcher_free(matcher);
+
+    matcher = docopt_matcher_new(p);
+    munit_assert_true(docopt_feed_expand(matcher, "naval_fate"));
+    munit_assert_false(docopt_feed_expand(matcher, arg));
+    m = docopt_matcher_match(matcher);
+    munit_assert_not_null(m.error);
+    docopt_match_free(&m);
+    docopt_matcher_free(matcher);
+
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult config(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    char path[] = "/tmp/docopt_test_XXXXXX";
+    int fd = mkstemp(path);
+    munit_assert_int(fd, >=, 0);
+    const char content[] = "# comment\nspeed = 25\nspeedy = 1\n  name=config\r\ndepth = 3\nspeed=30";
+    munit_assert_int(write(fd, content, strlen(content)), ==, strlen(content));
+    close(fd);
+    char arg[sizeof(path) + 16] = "--config=";
+    strcat(arg, path);
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog [options]\n"
+        "\n"
+        "Options:\n"
+        "  --config=FILE  Config file.\n"
+        "  --speed=KN     Speed [default: 10].\n"
+        "  --name=N       Name [env: DOCOPT_TEST_CONFIG_NAME].\n"
+        "  --depth=D      Depth.\n"
+        "  --width=W      Width [default: 4].\n";
+    const char *argv[] = {"prog", arg, "--depth=7"};
+
+    setenv("DOCOPT_TEST_CONFIG_NAME", "environment", 1);
+    Docopt_Pattern *p = docopt_compile(help_message);
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_null(m.error);
+    munit_assert_true(docopt_match_config(&m, "--config"));
+    int64_t i;
+    // the last line wins over the default, the value read is cached in option_value
+    munit_assert_int(m.option_value[docopt_option_bit(p, "--speed")].source, ==, DOCOPT_SOURCE_DEFAULT);
+    munit_assert_true(docopt_get_i64(&m, "--speed", &i));
+    munit_assert_int64(i, ==, 30);
+    munit_assert_int(m.option_value[docopt_option_bit(p, "--speed")].source, ==, DOCOPT_SOURCE_CONFIG);
+    // argv and the environment win over the file
+    munit_assert_true(docopt_get_i64(&m, "--depth", &i));
+    munit_assert_int64(i, ==, 7);
+    munit_assert_int(m.option_value[docopt_option_bit(p, "--name")].source, ==, DOCOPT_SOURCE_ENVIRONMENT);
+    munit_assert_true(docopt_get_i64(&m, "--width", &i));
+    munit_assert_int64(i, ==, 4);
+    docopt_match_free(&m);
+    unsetenv("DOCOPT_TEST_CONFIG_NAME");
+    docopt_pattern_free(p);
+
+    p = docopt_compile(help_message);
+    m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_true(docopt_match_config(&m, "--config"));
+    // option_value only holds what was known when matching
+    munit_assert_int(m.option_value[docopt_option_bit(p, "--name")].kind, ==, DOCOPT_VALUE_NONE);
+    munit_assert_int(docopt__match_get(&m, "--name").kind, ==, DOCOPT_VALUE_STRING);
+    munit_assert_string_equal(docopt__match_get(&m, "--name").string, "config");
+    docopt_match_free(&m);
+    unlink(path);
+
+    m = docopt_match(p, ARRAY_LEN(argv), argv);
+    munit_assert_false(docopt_match_config(&m, "--config"));
+    munit_assert_false(docopt_match_config(&m, "--speed-unknown"));
+    docopt_match_free(&m);
+
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult compile_once(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog open <file>...\n";
+    const char *argv[] = {"prog", "open", "a", "b"};
+
+    Docopt_Pattern *p = docopt_compile(help_message);
+    for (int i=0; i<3; i++) {
+        Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+        munit_assert_int(m.count, ==, 3);
+        munit_assert_string_equal(m.key[2], "<file>");
+        munit_assert_string_equal(m.values[2][1], "b");
+
+        docopt_match_free(&m);
+        munit_assert_int(m.count, ==, 0);
+        munit_assert_null(m.arena.block);
+    }
+    docopt_pattern_free(p);
+
+    return MUNIT_OK;
+}
+
+static MunitResult lazy(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage: prog open <file>...\n"
+        "       prog close <file>\n"
+        "       prog list\n";
+    const char *argv[] = {"prog", "close", "a"};
+
+    Docopt__Pattern p = docopt__compile_pattern(help_message);
+    munit_assert_size(p.upattern_count, ==, 3);
+    munit_assert_string_equal(p.prefix[p.usage[0].prefix].command.it, "open");
+    munit_assert_string_equal(p.prefix[p.usage[1].prefix].command.it, "close");
+    munit_assert_string_equal(p.prefix[p.usage[2].prefix].command.it, "list");
+    for (size_t i=0; i<p.upattern_count; i++) {
+        munit_assert_null(p.usage[i].upattern);
+    }
+
+    Docopt_Match m = docopt_match(&p, ARRAY_LEN(argv), argv);
+    munit_assert_int(m.count, ==, 3);
+    munit_assert_string_equal(m.value[1], "close");
+    munit_assert_null(p.usage[0].upattern);
+    munit_assert_not_null(p.usage[1].upattern);
+    munit_assert_null(p.usage[2].upattern);
+
+    docopt_match_free(&m);
+    docopt_pattern_free(&p);
+    return MUNIT_OK;
+}
+
+static void *lazy_thread(void *pattern) {
+    const char *argv[] = {"prog", "open", "a", "b"};
+    Docopt_Match m = docopt_match(pattern, ARRAY_LEN(argv), argv);
+    bool ok = m.error == NULL && m.count == 3 && m.length[2] == 2;
+    // and for the keys of the JSON before they are collected
+    char json[128];
+    docopt_match_json(pattern, &m, json, sizeof(json));
+    ok = ok && strcmp(json, "{\"open\": true, \"<file>\": [\"a\", \"b\"], \"close\": false}") == 0;
+    docopt_match_free(&m);
+    return ok ? pattern : NULL;
+}
+
+static MunitResult lazy_threads(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    // the threads all ask for the same line before it is compiled
+    Docopt_Pattern *p = docopt_compile(
+        "Usage: prog open <file>...\n"
+        "       prog close <file>\n");
+    pthread_t threads[8];
+    for (size_t i=0; i<ARRAY_LEN(threads); i++) {
+        munit_assert_int(pthread_create(&threads[i], NULL, lazy_thread, p), ==, 0);
+    }
+    for (size_t i=0; i<ARRAY_LEN(threads); i++) {
+        void *result;
+        munit_assert_int(pthread_join(threads[i], &result), ==, 0);
+        munit_assert_ptr_equal(result, p);
+    }
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult prefix(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog remote add <name> <url>\n"
+        "  prog remote rm <name>\n"
+        "  prog remote\n"
+        "  prog remote...\n"
+        "  prog <file>\n";
+
+    Docopt__Pattern p = docopt__compile_pattern(help_message);
+    munit_assert_int(p.usage[0].prefix_length, ==, 2);
+    munit_assert_int(p.usage[1].prefix_length, ==, 2);
+    munit_assert_int(p.usage[2].prefix_length, ==, 1);
+    munit_assert_int(p.usage[3].prefix_length, ==, 0);
+    munit_assert_int(p.usage[4].prefix_length, ==, 0);
+    // the lines share the node of remote
+    munit_assert_int(p.prefix[p.usage[0].prefix].parent, ==, p.usage[2].prefix);
+    munit_assert_int(p.prefix[p.usage[1].prefix].parent, ==, p.usage[2].prefix);
+    munit_assert_string_equal(p.prefix[p.usage[1].prefix].command.it, "rm");
+
+    const char *rm[] = {"prog", "remote", "rm", "a"};
+    Docopt_Match m = docopt_match(&p, ARRAY_LEN(rm), rm);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 4);
+    munit_assert_string_equal(m.key[3], "<name>");
+    // remote add is never compiled
+    munit_assert_null(p.usage[0].upattern);
+    docopt_match_free(&m);
+
+    const char *remote[] = {"prog", "remote"};
+    m = docopt_match(&p, ARRAY_LEN(remote), remote);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 2);
+    munit_assert_null(m.key[1]);
+    docopt_match_free(&m);
+
+    const char *repeated[] = {"prog", "remote", "remote"};
+    m = docopt_match(&p, ARRAY_LEN(repeated), repeated);
+    munit_assert_null(m.error);
+    munit_assert_int(m.count, ==, 3);
+    docopt_match_free(&m);
+
+    const char *file[] = {"prog", "add"};
+    m = docopt_match(&p, ARRAY_LEN(file), file);
+    munit_assert_null(m.error);
+    munit_assert_string_equal(m.key[1], "<file>");
+    docopt_match_free(&m);
+
+    Docopt_Matcher *matcher = docopt_matcher_new(&p);
+    for (size_t i=0; i<ARRAY_LEN(rm); i++) {
+        munit_assert_true(docopt_feed(matcher, rm[i]));
+    }
+    m = docopt_matcher_match(matcher);
+    munit_assert_null(m.error);
+    munit_assert_string_equal(m.value[3], "a");
+    docopt_match_free(&m);
+    docopt_matcher_free(matcher);
+
+    docopt_pattern_free(&p);
+    return MUNIT_OK;
+}
+
+static MunitResult match_buffer(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog open <file>...\n";
+    const char *argv[] = {"prog", "open", "a", "b", "c"};
+    int argc = ARRAY_LEN(argv);
+
+    Docopt_Pattern *p = docopt_compile(help_message);
+    size_t size = docopt_match_size(p, argc, argv);
+    char *buffer = malloc(size + 1);
+
+    Docopt_Match m;
+    munit_assert_false(docopt_match_buffer(p, argc, argv, buffer + 1, size - 1, &m));
+    // deliberately misaligned
+    munit_assert_true(docopt_match_buffer(p, argc, argv, buffer + 1, size, &m));
+    munit_assert_int(m.count, ==, 3);
+    munit_assert_string_equal(m.key[2], "<file>");
+    munit_assert_int(m.length[2], ==, 3);
+    munit_assert_string_equal(m.values[2][2], "c");
+    docopt_match_free(&m);
+
+    free(buffer);
+    docopt_pattern_free(p);
+
+    // the size covers what the stack expands to
+    p = docopt_compile("Usage: prog [-v] [-q] <x>\n\nOptions:\n  -v  Verbose.\n  -q  Quiet.\n");
+    const char *stack[] = {"prog", "-vq", "a"};
+    const char *expanded[] = {"prog", "-v", "-q", "a"};
+    size = docopt_match_size(p, ARRAY_LEN(stack), stack);
+    munit_assert_size(size, >=, docopt_match_size(p, ARRAY_LEN(expanded), expanded));
+    buffer = malloc(size);
+    munit_assert_true(docopt_match_buffer(p, ARRAY_LEN(stack), stack, buffer, size, &m));
+    munit_assert_null(m.error);
+    munit_assert_string_equal(m.value[m.count-1], "a");
+    docopt_match_free(&m);
+    free(buffer);
+    docopt_pattern_free(p);
+
+    return MUNIT_OK;
+}
+
+static bool has_word(const char **words, int count, const char *word) {
+    for (int i=0; i<count; i++) {
+        if (strcmp(words[i], word) == 0) return true;
+    }
+    return false;
+}
+
+static MunitResult complete(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    Docopt_Pattern *p = docopt_compile(naval_fate);
+    Docopt_Completion *c = docopt_completion_new(p);
+    const char **words;
+
+    const char *argv1[] = {"naval_fate", ""};
+    int n = docopt_complete(c, ARRAY_LEN(argv1), argv1, &words);
+    munit_assert_int(n, ==, 5);
+    munit_assert_true(has_word(words, n, "ship"));
+    munit_assert_true(has_word(words, n, "mine"));
+    munit_assert_true(has_word(words, n, "-h"));
+    munit_assert_true(has_word(words, n, "--help"));
+    munit_assert_true(has_word(words, n, "--version"));
+
+    const char *argv2[] = {"naval_fate", "ship", "s"};
+    n = docopt_complete(c, ARRAY_LEN(argv2), argv2, &words);
+    munit_assert_int(n, ==, 1);
+    munit_assert_string_equal(words[0], "shoot");
+
+    const char *argv3[] = {"naval_fate", "ship", "beagle", "move", "1", "2", "--"};
+    n = docopt_complete(c, ARRAY_LEN(argv3), argv3, &words);
+    munit_assert_int(n, ==, 1);
+    munit_assert_string_equal(words[0], "--speed");
+
+    const char *argv4[] = {"naval_fate", "mine", ""};
+    n = docopt_complete(c, ARRAY_LEN(argv4), argv4, &words);
+    munit_assert_int(n, ==, 2);
+    munit_assert_true(has_word(words, n, "set"));
+    munit_assert_true(has_word(words, n, "remove"));
+
+    const char *argv5[] = {"naval_fate", "fly", ""};
+    n = docopt_complete(c, ARRAY_LEN(argv5), argv5, &words);
+    munit_assert_int(n, ==, 0);
+
+    docopt_completion_free(c);
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult emit_pattern(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog [<a>]\n"
+        "\n"
+        "Options:\n"
+        "  -v --verbose  Talk.\n";
+    const char expect[] =
+        "static const Docopt__UPattern prog__unode[] = {\n"
+        "    /*   0 */ {.kind = DOCOPT__UPATTERN_SIMPLE, .name = {\"prog\"}},\n"
+        "    /*   1 */ {.kind = DOCOPT__UPATTERN_GROUP, .optional = true, .head = &prog__unode[2]},\n"
+        "    /*   2 */ {.kind = DOCOPT__UPATTERN_SIMPLE, .name = {\"<a>\"}},\n"
+        "};\n"
+        "\n"
+        "static const Docopt__UPattern prog__upattern[] = {\n"
+        "    {.kind = DOCOPT__UPATTERN_ROOT, .head = &prog__unode[0], .rest = &prog__unode[1]},\n"
+        "};\n"
+        "\n"
+        "static const Docopt__OPattern prog__opattern[] = {\n"
+        "    {.key = {{\"-v\"}, {\"--verbose\"}}, .value = {\"\"}},\n"
+        "};\n"
+        "\n"
+        "static const unsigned char prog__short_option[256] = {\n"
+        "    [118] = 1,\n"
+        "};\n"
+        "\n"
+        "static const char *const prog__option_key[] = {\n"
+        "    prog__opattern[0].key[1].it,\n"
+        "};\n"
+        "\n"
+        "static const Docopt__Leaf prog__leaf[] = {\n"
+        "    {.kind = DOCOPT__LEAF_PROGRAM, .node = &prog__unode[0], .key = {\"prog\"}},\n"
+        "    {.kind = DOCOPT__LEAF_ARGUMENT, .node = &prog__unode[2], .key = {\"<a>\"}},\n"
+        "};\n"
+        "\n"
+        "static const uint64_t prog__set[] = {\n"
+        "    0x0000000000000002ull,\n"
+        "    0x0000000000000000ull,\n"
+        "    0x0000000000000003ull,\n"
+        "};\n"
+        "\n"
+        "static const Docopt__Automaton prog__automaton[] = {\n"
+        "    {.leaf_count = 2, .leaf = &prog__leaf[0], .words = 1, .follow = &prog__set[0], .last = &prog__set[2], .ll1 = true},\n"
+        "};\n"
+        "\n"
+        "static const Docopt__Key prog__key[] = {\n"
+        "    {.key = \"<a>\", .valued = true},\n"
+        "    {.key = \"--verbose\", .bit = 1},\n"
+        "};\n"
+        "\n"
+        "static Docopt__Keys prog__keys = {.state = DOCOPT__USAGE_COMPILED, .count = 2, .key = prog__key};\n"
+        "\n"
+        "static const Docopt_Pattern prog = {\n"
+        "    .upattern_count = 1,\n"
+        "    .upattern = prog__upattern,\n"
+        "    .automaton = prog__automaton,\n"
+        "    .opattern_count = 1,\n"
+        "    .opattern = prog__opattern,\n"
+        "    .short_option = prog__short_option,\n"
+        "    .option_key = prog__option_key,\n"
+        "    .keys = &prog__keys,\n"
+        "};\n";
+
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&buf, &len);
+    Docopt__Pattern p = docopt__compile_pattern(help_message);
+    docopt__emit_pattern(out, &p, "prog");
+    fclose(out);
+
+    munit_assert_string_equal(buf, expect);
+
+    free(buf);
+    docopt_pattern_free(&p);
+    return MUNIT_OK;
+}
+
+static MunitResult emit_completion(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char help_message[] =
+        "Usage:\n"
+        "  prog go <x> [--fast]\n"
+        "  prog stop\n"
+        "\n"
+        "Options:\n"
+        "  -f --fast  Fast.\n";
+    const char expect[] =
+        "_prog() {\n"
+        "    local line=\"${COMP_LINE:0:COMP_POINT}\" state=0 word cur=\n"
+        "    local -a words\n"
+        "    read -ra words <<< \"$line\"\n"
+        "    [[ $line == *[[:space:]] ]] || { cur=\"${words[-1]}\"; unset 'words[-1]'; }\n"
+        "    for word in \"${words[@]:1}\"; do\n"
+        "        case \"$state:$word\" in\n"
+        "            '0:go') state=1 ;;\n"
+        "            '0:stop') state=2 ;;\n"
+        "            '1:-'?*) return ;;\n"
+        "            '1:'*) state=3 ;;\n"
+        "            '3:-f') state=4 ;;\n"
+        "            '3:--fast') state=4 ;;\n"
+        "            *) return ;;\n"
+        "        esac\n"
+        "    done\n"
+        "    case $state in\n"
+        "        0) COMPREPLY=($(compgen -W 'go stop' -- \"$cur\")) ;;\n"
+        "        1) COMPREPLY=($(compgen -f -- \"$cur\")) ;;\n"
+        "        3) COMPREPLY=($(compgen -W '-f --fast' -- \"$cur\")) ;;\n"
+        "    esac\n"
+        "}\n"
+        "\n"
+        "complete -F _prog prog\n";
+
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&buf, &len);
+    Docopt__Pattern p = docopt__compile_pattern(help_message);
+    munit_assert_true(docopt__emit_completion(out, &p, "bash"));
+    munit_assert_false(docopt__emit_completion(out, &p, "tcsh"));
+    fclose(out);
+
+    munit_assert_string_equal(buf, expect);
+
+    free(buf);
+    docopt_pattern_free(&p);
+    return MUNIT_OK;
+}
+
+static MunitResult match_json(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char *argv[] = {"naval_fate", "ship", "create", "a\"b", "c\nd\001"};
+    const char expect[] =
+        "{\"ship\": true, \"create\": true, \"<name>\": [\"a\\\"b\", \"c\\nd\\u0001\"], "
+        "\"move\": false, \"<x>\": null, \"<y>\": null, \"--speed\": \"10\", \"shoot\": false, "
+        "\"mine\": false, \"set\": false, \"remove\": false, \"--moored\": false, \"--drifting\": false, "
+        "\"--help\": false, \"--version\": false}";
+    Docopt_Pattern *p = docopt_compile(naval_fate);
+    Docopt_Match m = docopt_match(p, ARRAY_LEN(argv), argv);
+
+    char buf[sizeof(expect)];
+    munit_assert_size(docopt_match_json(p, &m, buf, sizeof(buf)), ==, strlen(expect));
+    munit_assert_string_equal(buf, expect);
+
+    // like snprintf the result is truncated but terminated
+    char small[8];
+    munit_assert_size(docopt_match_json(p, &m, small, sizeof(small)), ==, strlen(expect));
+    munit_assert_string_equal(small, "{\"ship\"");
+    docopt_match_free(&m);
+
+    // flags are only in the bitset of the match
+    const char *flags[] = {"naval_fate", "mine", "set", "1", "2", "--moored"};
+    const char expect_flags[] =
+        "{\"ship\": false, \"create\": false, \"<name>\": [], "
+        "\"move\": false, \"<x>\": \"1\", \"<y>\": \"2\", \"--speed\": \"10\", \"shoot\": false, "
+        "\"mine\": true, \"set\": true, \"remove\": false, \"--moored\": true, \"--drifting\": false, "
+        "\"--help\": false, \"--version\": false}";
+    m = docopt_match(p, ARRAY_LEN(flags), flags);
+    char buf_flags[sizeof(expect_flags)];
+    munit_assert_size(docopt_match_json(p, &m, buf_flags, sizeof(buf_flags)), ==, strlen(expect_flags));
+    munit_assert_string_equal(buf_flags, expect_flags);
+    docopt_match_free(&m);
+
+    // the keys of the Options section that no usage line names follow with their defaults
+    const char *words[] = {"prog"};
+    const char expect_words[] = "{\"--path\": [\"a\", \"b\"], \"-q\": false, \"--out\": null}";
+    Docopt_Pattern *q = docopt_compile(
+        "Usage: prog [--path=<p>...]\n\nOptions:\n  --path=<p>  Paths [default: a b].\n  -q  Quiet.\n  --out=<f>  Output.\n");
+    m = docopt_match(q, ARRAY_LEN(words), words);
+    char buf_words[sizeof(expect_words)];
+    munit_assert_size(docopt_match_json(q, &m, buf_words, sizeof(buf_words)), ==, strlen(expect_words));
+    munit_assert_string_equal(buf_words, expect_words);
+    docopt_match_free(&m);
+
+    docopt_pattern_free(q);
+    docopt_pattern_free(p);
+    return MUNIT_OK;
+}
+
+static MunitResult match_stream(const MunitParameter params[], void *user_data_or_fixture) {
+    (void) params;
+    (void) user_data_or_fixture;
+
+    const char input[] =
+        "naval_fate\0ship\0create\0a\0b\n"
+        "naval_fate\0mine\0set\0001\0002\0--moored\n"
+        "naval_fate\0ship\0new\0\"x\"\n";
+    const char expect[] =
+        "{\"ship\": true, \"create\": true, \"<name>\": [\"a\", \"b\"], "
+        "\"move\": false, \"<x>\": null, \"<y>\": null, \"--speed\": \"10\", \"shoot\": false, "
+        "\"mine\": false, \"set\": false, \"remove\": false, \"--moored\": false, \"--drifting\": false, "
+        "\"--help\": false, \"--version\": false}\n"
+        "{\"ship\": false, \"create\": false, \"<name>\": [], "
+        "\"move\": false, \"<x>\": \"1\", \"<y>\": \"2\", \"--speed\": \"10\", \"shoot\": false, "
+        "\"mine\": true, \"set\": true, \"remove\": false, \"--moored\": true, \"--drifting\": false, "
+        "\"--help\": false, \"--version\": false}\n"
+        "\"user-error\"\n";
+
+    FILE *in = fmemopen((void *) input, sizeof(input) - 1, "r");
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&buf, &len);
+    Docopt__Pattern p = docopt__compile_pattern(naval_fate);
+    docopt__match_stream(in, out, &p);
+    fclose(out);
+    fclose(in);
+
+    munit_assert_string_equal(buf, expect);
+
+    free(buf);
+    docopt_pattern_free(&p);
+
+    // the buffer holds the stacked short options one by one
+    const char stacked_input[] = "prog\0-vvvvv\n";
+    in = fmemopen((void *) stacked_input, sizeof(stacked_input) - 1, "r");
+    out = open_memstream(&buf, &len);
+    p = docopt__compile_pattern("Usage: prog [-v...]\n\nOptions:\n  -v  Verbose.\n");
+    docopt__match_stream(in, out, &p);
+    fclose(out);
+    fclose(in);
+    munit_assert_string_equal(buf, "{\"-v\": 5}\n");
+    free(buf);
+    docopt_pattern_free(&p);
     return MUNIT_OK;
 }
 
@@ -533,6 +1826,14 @@ MunitTest test_array[] = {
         MUNIT_TEST_OPTION_NONE,
         NULL,
     },
+    {
+        "/compile/upattern/simplify",
+        simplify,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
     {
         "/compile/opattern/no_argument",
         option_no_arg,
@@ -589,6 +1890,182 @@ MunitTest test_array[] = {
         MUNIT_TEST_OPTION_NONE,
         NULL,
     },
+    {
+        "/interpret/options",
+        interpret_options,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/passthrough",
+        passthrough,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/options_first",
+        options_first,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/stacked",
+        stacked,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/repeated_options",
+        repeated_options,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/typed",
+        typed,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/environment",
+        environment,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/tokens",
+        tokens,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/ll1",
+        ll1,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/feed",
+        feed,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/feed_expand",
+        feed_expand,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/config",
+        config,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/compile_once",
+        compile_once,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/lazy",
+        lazy,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/lazy/threads",
+        lazy_threads,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/prefix",
+        prefix,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/interpret/match_buffer",
+        match_buffer,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/complete",
+        complete,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/emit/pattern",
+        emit_pattern,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/emit/json",
+        match_json,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/emit/match_stream",
+        match_stream,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
+    {
+        "/emit/completion",
+        emit_completion,
+        NULL,
+        NULL,
+        MUNIT_TEST_OPTION_NONE,
+        NULL,
+    },
     { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
 };
 